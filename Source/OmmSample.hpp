@@ -1,7 +1,13 @@
 // © 2022 NVIDIA Corporation
+#include <atomic>
 #include <future>
+#include <limits>
 #include <map>
+#include <mutex>
+#include <queue>
 #include <set>
+#include <thread>
+#include "VisibilityMasks/OmmBakeInputs.h"
 #include "VisibilityMasks/OmmHelper.h"
 
 #include "NRIFramework.h"
@@ -425,6 +431,16 @@ static inline nri::TextureBarrierDesc TextureBarrierFromState(nri::TextureBarrie
 }
 
 #pragma region[ OmmSample specific ]
+constexpr uint32_t OMM_PROGRESSIVE_COARSE_SUBDIVISION_LEVEL = 4; // first pass of the progressive bake, refined to the target level afterwards
+constexpr uint64_t OMM_CPU_BAKER_BATCH_OUTPUT_SIZE = 64 * 1024 * 1024; // predicted output per cpu baker batch
+constexpr double OMM_BUDGET_TWO_STATE_VALUE = 0.75;                    // worth of an OC1_2_STATE mask relative to OC1_4_STATE in budgeted bakes: no any-hit left, but unknown states are guessed
+constexpr uint64_t OMM_GPU_BAKER_TRANSIENT_BUDGET = 256 * 1024 * 1024; // upper bound of the transient pool memory split into per geometry slices, if a bake holds several geometries
+constexpr uint32_t OMM_GPU_BAKER_MAX_TRANSIENT_SLICES = 16;
+constexpr uint64_t OMM_RETIRED_GEOMETRY_MEMORY_LIMIT = 256 * 1024 * 1024; // helper heaps are never compacted, past this much retired geometry all masked geometry is rebuilt into fresh heaps
+constexpr int32_t OMM_GPU_BAKER_BUFFER_POOL_BUDGET_MB = 512;           // default budget for idle gpu baker buffers kept for the next bake
+constexpr uint64_t OMM_GPU_BAKER_BUFFER_POOL_MIN_SIZE = 64 * 1024;    // smallest size class of the gpu baker buffer pool
+constexpr double OMM_GPU_BAKER_BUFFER_POOL_MAX_SLACK = 1.5;            // an idle buffer is reused for requests whose size class is up to this much smaller
+
 struct AlphaTestedGeometry {
     ommhelper::OmmBakeGeometryDesc bakeDesc;
     ommhelper::MaskedGeometryBuildDesc buildDesc;
@@ -446,12 +462,28 @@ struct AlphaTestedGeometry {
     uint64_t indexBufferSize;
     uint64_t indexOffset;
 
+    std::vector<uint8_t> croppedUvData; // cpu baker uvs remapped to the decoded alpha crop
+    nri::Format croppedUvFormat;
+    float uvMin[2];
+    float uvMax[2];
+
+    uint64_t predictedSizes[(uint32_t)ommhelper::OmmDataLayout::BlasBuildGpuBuffersNum]; // upper estimate of the baker output, see PredictOmmOutputSizes()
+
+    uint32_t resolvedSubdivisionLevel; // per geometry level and format resolved once per update, see ResolveOmmGeometryBakeParams()
+    ommhelper::OmmFormats resolvedFormat;
+
+    uint64_t inputHash;      // effective bake inputs, see UpdateOmmGeometryDirtyState()
+    uint64_t builtInputHash; // inputs of the published masked geometry, 0 if there is none
+    bool isDirty;            // rebaked and swapped by the next update, the rest stays live
+
     uint32_t meshIndex;
     uint32_t materialIndex;
+    uint32_t alphaSourceIndex; // cpu baker only
+    uint64_t meshContentHash;  // part of the cache key, see GetOmmCacheHash()
 
     const nri::Format vertexFormat = nri::Format::RGB32_SFLOAT;
-    const nri::Format uvFormat = nri::Format::RG32_SFLOAT;
-    const nri::Format indexFormat = nri::Format::R16_UINT;
+    nri::Format uvFormat;    // narrowest encoding within ommhelper::OMM_UV_MAX_TEXEL_ERROR
+    nri::Format indexFormat; // R16_UINT if all indices fit
 };
 
 struct OmmGpuBakerPrebuildMemoryStats {
@@ -465,6 +497,40 @@ struct OmmBatch {
     size_t offset;
     size_t count;
 };
+
+struct OmmPredictionCalibration { // actual / predicted baker output sizes observed so far, bound the prediction error
+    double ratioMin[(uint32_t)ommhelper::OmmDataLayout::BlasBuildGpuBuffersNum];
+    double ratioMax[(uint32_t)ommhelper::OmmDataLayout::BlasBuildGpuBuffersNum];
+    uint32_t sampleNum;
+};
+
+struct AlphaSource { // decoded alpha shared by all geometries whose textures have identical content
+    utils::Texture* texture;
+    std::vector<uint8_t> decodedAlpha;       // mips not mapped from the alpha cache, empty while the source is not resident
+    const uint8_t* mipData[OMM_MAX_MIP_NUM]; // valid while resident
+    uint64_t mipCacheKeys[OMM_MAX_MIP_NUM];  // alpha cache keys of decoded mips, 0 if the mip doesn't need to be stored
+    ommhelper::AlphaRegion regions[OMM_MAX_MIP_NUM];
+    ommhelper::AlphaCrop crop;
+    float uvMin[2];
+    float uvMax[2];
+    size_t decodedSize;
+    uint64_t lastUseTick;
+    uint32_t textureIndex;
+    uint32_t mipOffset;
+    uint32_t mipNum;
+    uint32_t lastGeometryIndex;
+    bool isMipMapped[OMM_MAX_MIP_NUM];
+    bool isResident;
+};
+
+struct AlphaDecodeJob { // a range of texel rows of a single mip, decoded into AlphaSource::decodedAlpha
+    detexTexture* texture;
+    ommhelper::AlphaRegion region;
+    uint8_t* outAlpha;
+    uint32_t rowBegin;
+    uint32_t rowEnd;
+    uint32_t alphaSourceIndex;
+};
 #pragma endregion
 
 class Sample : public SampleBase {
@@ -741,33 +807,86 @@ private: // OMM:
 
     void RebuildOmmGeometry();
     void RebuildOmmGeometryAsync(uint32_t const* frameId);
-    void OmmGeometryUpdate(OmmNriContext& context, bool doBatching);
+    void OmmGeometryUpdate(OmmNriContext& context, bool doBatching, bool hotSwap = false);
+    inline bool IsOmmBakeCancelled() const { return m_OmmBakeCancel.load(std::memory_order_relaxed); }
 
+    void LoadOmmMaterialOverrides();
+    void ResolveOmmGeometryBakeParams();
+    uint32_t UpdateOmmGeometryDirtyState();
     void FillOmmBakerInputs();
+    void MakeAlphaSourceResident(uint32_t alphaSourceIndex);
+    void ReleaseAlphaSource(uint32_t alphaSourceIndex);
+    void ReleaseAlphaSources();
+    void StreamAlphaSources(const OmmBatch& batch);
+    void ReleaseUnusedAlphaSources(const OmmBatch& batch);
+    void LaunchAlphaDecode();
+    bool RunNextAlphaDecodeJob();
+    void WaitForAlphaDecode(uint32_t alphaSourceIndex);
+    void JoinAlphaDecodeWorkers();
     void FillOmmBlasBuildQueue(const OmmBatch& batch, std::vector<ommhelper::MaskedGeometryBuildDesc*>& outBuildQueue);
 
     void RunOmmSetupPass(OmmNriContext& context, ommhelper::OmmBakeGeometryDesc** queue, size_t count, OmmGpuBakerPrebuildMemoryStats& memoryStats);
     void BakeOmmGpu(OmmNriContext& context, std::vector<ommhelper::OmmBakeGeometryDesc*>& batch);
     OmmGpuBakerPrebuildMemoryStats GetGpuBakerPrebuildMemoryStats(bool printStats);
+    OmmGpuBakerPrebuildMemoryStats PredictOmmOutputSizes(bool printStats);
+    void CalibrateOmmOutputPrediction(const OmmBatch& batch);
+    OmmPredictionCalibration& GetOmmPredictionCalibration() { return m_OmmPredictionCalibrations[ommhelper::OmmCaching::CalculateSateHash(m_OmmBakeDesc)]; }
+    void ApplyOmmMemoryBudget();
 
-    void CreateAndBindGpuBakerSatitcBuffers(const OmmGpuBakerPrebuildMemoryStats& memoryStats);
+    void CreateAndBindGpuBakerSatitcBuffers(const OmmGpuBakerPrebuildMemoryStats& memoryStats, uint32_t maxGeometriesPerBake);
     void CreateAndBindGpuBakerArrayDataBuffer(const OmmGpuBakerPrebuildMemoryStats& memoryStats);
     void CreateAndBindGpuBakerReadbackBuffer(const OmmGpuBakerPrebuildMemoryStats& memoryStats);
+    nri::Buffer* AcquireOmmBakerBuffer(uint64_t size, nri::BufferUsageBits usage, nri::MemoryLocation location);
+    void ReleaseOmmBakerBuffers();
+    void TrimOmmBakerBufferPool(uint64_t budget);
 
     inline uint64_t GetInstanceHash(uint32_t meshId, uint32_t materialId) {
         return uint64_t(meshId) << 32 | uint64_t(materialId);
     };
 
+    inline uint64_t GetOmmCacheHash(const AlphaTestedGeometry& geometry) { // shared with the headless bake tool, see Tools/OmmBakeTool.cpp
+        const ommhelper::InputTexture& texture = geometry.bakeDesc.texture;
+        uint64_t textureContentHash = GetAlphaTextureContentHash(m_Scene.materials[geometry.materialIndex].baseColorTexIndex, texture.mipOffset, texture.mipNum);
+        return ommhelper::OmmCaching::CalculateGeometryHash(geometry.meshIndex, geometry.materialIndex, geometry.meshContentHash, textureContentHash, geometry.bakeDesc, m_OmmBakeDesc);
+    };
+
     inline std::string GetOmmCacheFilename() {
         return m_OmmCacheFolderName + std::string("/") + m_SceneName;
     };
 
+    inline std::string GetOmmAlphaCacheFolderName() {
+        return m_OmmCacheFolderName + std::string("/AlphaMips");
+    };
+
+    inline std::string GetOmmPipelineCacheFilename() {
+        return m_OmmCacheFolderName + std::string("/GpuBakerPipelines.bin");
+    };
+
+    inline uint32_t GetOmmGeometrySubdivisionLevel(const AlphaTestedGeometry& geometry) const { // the coarse pass of a progressive bake lowers the global level
+        return std::min(geometry.resolvedSubdivisionLevel, m_OmmBakeDesc.subdivisionLevel);
+    }
+
+    inline const ommhelper::OmmMaterialBakeParams& GetOmmMaterialBakeParams(uint32_t materialIndex) {
+        static const ommhelper::OmmMaterialBakeParams defaultParams = {};
+        const auto& it = m_OmmMaterialOverrides.find(materialIndex);
+        return it != m_OmmMaterialOverrides.end() ? it->second : defaultParams;
+    };
+
+    uint64_t GetAlphaMipContentHash(uint32_t textureIndex, uint32_t mipId);
+    uint64_t GetAlphaTextureContentHash(uint32_t textureIndex, uint32_t mipOffset, uint32_t mipNum);
+
     void InitializeOmmGeometryFromCache(const OmmBatch& batch, std::vector<ommhelper::OmmBakeGeometryDesc*>& outBakeQueue);
     void SaveMaskCache(const OmmBatch& batch);
 
     nri::AccelerationStructure* GetMaskedBlas(uint64_t insatanceMask);
 
+    struct OmmBlas;
+    void PublishMaskedBlas(uint64_t instanceMask, const OmmBlas& ommBlas);
+
     void ReleaseMaskedGeometry();
+    void ReleaseRetiredMaskedGeometry();
+    bool IsRetiredMaskedGeometryOverLimit();
+    void StopUsingMaskedGeometry(uint32_t const* frameId);
     void ReleaseBakingResources();
 
     void AppendOmmImguiSettings();
@@ -788,18 +907,41 @@ private:
 
     // preprocessed alpha geometry from the scene:
     std::vector<AlphaTestedGeometry> m_OmmAlphaGeometry;
+    std::map<uint32_t, ommhelper::OmmMaterialBakeParams> m_OmmMaterialOverrides; // material index -> bake params, reloaded before every bake
     std::vector<nri::Memory*> m_OmmAlphaGeometryMemories;
     std::vector<nri::Buffer*> m_OmmAlphaGeometryBuffers;
 
     // temporal resources for baking
-    std::vector<uint8_t> m_OmmRawAlphaChannelForCpuBaker;
+    std::vector<AlphaSource> m_OmmAlphaSources;
+    std::vector<AlphaDecodeJob> m_OmmAlphaDecodeJobs;
+    std::vector<std::future<void>> m_OmmAlphaDecodeWorkers;
+    std::vector<std::atomic<uint32_t>> m_OmmAlphaDecodePendingJobs; // per alpha source, baking of a geometry waits until it reaches zero
+    std::atomic<size_t> m_OmmAlphaDecodeNextJob{0};
+    size_t m_OmmAlphaResidentSize = 0;
+    size_t m_OmmAlphaStreamingBudget = 0; // 0 - every alpha source is decoded up front and kept until the end of the bake
+    uint64_t m_OmmAlphaUseTick = 0;
+    std::map<uint64_t, uint64_t> m_OmmAlphaMipContentHashes; // textureIndex << 32 | mipId -> content hash. Scene textures are immutable, so each mip is hashed once
+
+    std::map<uint64_t, OmmPredictionCalibration> m_OmmPredictionCalibrations; // per bake state hash, outputs of different settings don't mix
+    std::atomic<uint64_t> m_OmmBudgetPredictedSize{0}; // output of the last budgeted bake, see ApplyOmmMemoryBudget(). Written by the bake thread, read by the UI
+    BakerBindStats m_OmmBakeBindStats = {};            // gpu baker binds summed over the batches of the current bake, reported once at its end
 
     nri::Buffer* m_OmmGpuOutputBuffers[(uint32_t)ommhelper::OmmDataLayout::GpuOutputNum] = {};
     nri::Buffer* m_OmmGpuReadbackBuffers[(uint32_t)ommhelper::OmmDataLayout::GpuOutputNum] = {};
     nri::Buffer* m_OmmGpuTransientBuffers[OMM_MAX_TRANSIENT_POOL_BUFFERS] = {};
 
+    struct OmmPooledBuffer { // gpu baker buffer with its own memory, so it can outlive the bake
+        nri::Buffer* buffer;
+        std::vector<nri::Memory*> memories;
+        uint64_t size; // size class
+        nri::BufferUsageBits usage;
+        nri::MemoryLocation location;
+    };
+    std::vector<OmmPooledBuffer> m_OmmGpuBufferPool; // idle, least recently used first
+    std::vector<OmmPooledBuffer> m_OmmGpuBuffersInUse;
+    uint64_t m_OmmGpuBufferPoolSize = 0; // idle bytes
+
     std::vector<nri::Buffer*> m_OmmCpuUploadBuffers;
-    std::vector<nri::Memory*> m_OmmBakerAllocations;
     std::vector<nri::Memory*> m_OmmTmpAllocations;
 
     // misc
@@ -810,19 +952,30 @@ private:
         nri::AccelerationStructure* blas;
         //[!] VK Warning! VkMicromapExt wrapping is not supported yet. Use OmmHelper::DestroyMaskedGeometry instead of nri on release.
         nri::Buffer* ommArray;
+        uint64_t size; // in the helper heaps
     };
 
-    std::map<uint64_t, OmmBlas> m_InstanceMaskToMaskedBlasData;
+    std::map<uint64_t, OmmBlas> m_InstanceMaskToMaskedBlasData; // guarded by m_MaskedBlasMutex, read by the render thread during async bakes
     std::vector<OmmBlas> m_MaskedBlasses;
+    std::vector<OmmBlas> m_RetiredMaskedBlasses; // replaced by a refined version, destroyed once no frame in flight references them
+    uint64_t m_RetiredMaskedGeometrySize = 0; // destroyed, but still occupying the helper heaps until ReleaseMaskedGeometry()
+    std::mutex m_MaskedBlasMutex;
     ommhelper::OmmBakeDesc m_OmmBakeDesc = {};
     std::string m_SceneName = "Scene";
     std::string m_OmmCacheFolderName = "_OmmCache";
     uint32_t m_OmmUpdateProgress = 0;
+    std::atomic<const char*> m_OmmBakeStage{nullptr}; // pass of the running or last bake, shown by the UI. nullptr before the first bake
+    std::atomic<uint32_t> m_OmmBakeDirtyNum{0};      // geometries rebaked by the running or last bake
     bool m_EnableOmm = true;
     bool m_ShowFullSettings = false;
     bool m_IsOmmBakingActive = false;
+    ommhelper::OmmCancelToken m_OmmBakeCancel{false}; // checked at geometry and batch boundaries, finished batches stay published and cached
     bool m_ShowOnlyAlphaTestedGeometry = false;
     bool m_EnableAsync = true;
+    bool m_EnableProgressiveBake = false;
+    bool m_EnableIncrementalBake = true;
+    std::vector<bool> m_OmmUpdateFilter; // if not empty, geometries outside of it are kept as they are by the next update
+    int32_t m_OmmGpuBufferPoolBudgetMb = OMM_GPU_BAKER_BUFFER_POOL_BUDGET_MB;
     bool m_DisableOmmBlasBuild = false;
 
 private:
@@ -885,6 +1038,11 @@ Sample::~Sample() {
     m_Profiler.Destroy();
     ReleaseMaskedGeometry();
     ReleaseBakingResources();
+    TrimOmmBakerBufferPool(0);
+    if (m_OmmBakeDesc.enableCache) {
+        ommhelper::OmmCaching::CreateFolder(m_OmmCacheFolderName.c_str());
+        m_OmmHelper.SaveGpuBakerPipelineCache(GetOmmPipelineCacheFilename().c_str());
+    }
     m_OmmHelper.Destroy();
     m_OmmGraphicsContext.Destroy(NRI);
     m_OmmComputeContext.Destroy(NRI);
@@ -1116,6 +1274,8 @@ bool Sample::Initialize(nri::GraphicsAPI graphicsAPI, bool) {
 #pragma region[ Omm Sample specific ]
     InitAlphaTestedGeometry();
     m_OmmHelper.Initialize(m_Device, m_DisableOmmBlasBuild);
+    if (m_OmmBakeDesc.enableCache && m_OmmBakeDesc.type == ommhelper::OmmBakerType::GPU)
+        m_OmmHelper.CreateCachedGpuBakerPipelines(GetOmmPipelineCacheFilename().c_str()); // only the pipelines a previous session baked with, the rest stay lazy
     m_Profiler.Init(m_Device);
     m_OmmGraphicsContext.Init(NRI, m_Device, nri::QueueType::GRAPHICS);
     m_OmmComputeContext.Init(NRI, m_Device, nri::QueueType::COMPUTE);
@@ -1185,51 +1345,49 @@ void BindBuffersToMemory(NRIInterface& nri, nri::Device* device, nri::Buffer** b
 }
 
 nri::AccelerationStructure* Sample::GetMaskedBlas(uint64_t insatanceMask) {
+    std::lock_guard<std::mutex> lock(m_MaskedBlasMutex);
     const auto& it = m_InstanceMaskToMaskedBlasData.find(insatanceMask);
     if (it != m_InstanceMaskToMaskedBlasData.end())
         return it->second.blas;
     return nullptr;
 }
 
-std::vector<uint32_t> FilterOutAlphaTestedGeometry(const utils::Scene& scene) { // Filter out alphaOpaque geometry by mesh and material IDs
-    std::vector<uint32_t> result;
-    std::set<uint64_t> processedCombinations;
-    for (uint32_t instaceId = 0; instaceId < (uint32_t)scene.instances.size(); ++instaceId) {
-        const utils::Instance& instance = scene.instances[instaceId];
-        const utils::Material& material = scene.materials[instance.materialIndex];
-        if (material.IsAlphaOpaque()) {
-            uint64_t mask = uint64_t(instance.meshInstanceIndex) << 32 | uint64_t(instance.materialIndex);
-            size_t currentCount = processedCombinations.size();
-            processedCombinations.insert(mask);
-            bool isDuplicate = processedCombinations.size() == currentCount;
-            if (isDuplicate == false)
-                result.push_back(instaceId);
-        }
-    }
-    return result;
-}
-
 void Sample::InitAlphaTestedGeometry() {
     printf("[OMM] Initializing Alpha Tested Geometry\n");
-    std::vector<uint32_t> alphaInstances = FilterOutAlphaTestedGeometry(m_Scene);
+    std::vector<uint32_t> alphaInstances = ommhelper::FilterOutAlphaTestedGeometry(m_Scene);
 
     if (alphaInstances.empty())
         return;
 
+    std::stable_sort(alphaInstances.begin(), alphaInstances.end(), [this](uint32_t a, uint32_t b) { // geometries sharing a texture stay contiguous, so a cpu batch bakes them in one call
+        return m_Scene.materials[m_Scene.instances[a].materialIndex].baseColorTexIndex < m_Scene.materials[m_Scene.instances[b].materialIndex].baseColorTexIndex;
+    });
+
     m_OmmAlphaGeometry.resize(alphaInstances.size());
 
     size_t positionBufferSize = 0;
     size_t indexBufferSize = 0;
     size_t uvBufferSize = 0;
 
-    for (size_t i = 0; i < alphaInstances.size(); ++i) { // Calculate buffer sizes
+    size_t compactInputSize = 0;
+    size_t fullInputSize = 0;
+    for (size_t i = 0; i < alphaInstances.size(); ++i) { // Encode baker inputs and calculate buffer sizes
         const utils::Instance& instance = m_Scene.instances[alphaInstances[i]];
         const utils::Mesh& mesh = m_Scene.meshes[instance.meshInstanceIndex];
+        const utils::Material& material = m_Scene.materials[instance.materialIndex];
+        AlphaTestedGeometry& geometry = m_OmmAlphaGeometry[i];
+
+        geometry.uvFormat = ommhelper::EncodeOmmMeshUvs(m_Scene, mesh, m_Scene.textures[material.baseColorTexIndex], geometry.uvData);
+        geometry.indexFormat = ommhelper::EncodeOmmIndices(m_Scene.indices.data() + mesh.indexOffset, mesh.indexNum, geometry.indexData);
+        geometry.meshContentHash = ommhelper::CalculateMeshContentHash(m_Scene, mesh);
+        compactInputSize += geometry.uvData.size() + geometry.indexData.size();
+        fullInputSize += mesh.vertexNum * sizeof(float2) + mesh.indexNum * sizeof(utils::Index);
 
         positionBufferSize += helper::Align(mesh.vertexNum * sizeof(float3), 256);
-        indexBufferSize += helper::Align(mesh.indexNum * sizeof(utils::Index), 256);
-        uvBufferSize += helper::Align(mesh.vertexNum * sizeof(float2), 256);
+        indexBufferSize += helper::Align(geometry.indexData.size(), 256);
+        uvBufferSize += helper::Align(geometry.uvData.size(), 256);
     }
+    printf("[OMM] Baker uv and index inputs: %.2f MB (%.2f MB uncompressed)\n", double(compactInputSize) / (1024.0 * 1024.0), double(fullInputSize) / (1024.0 * 1024.0));
 
     m_OmmAlphaGeometryBuffers.reserve(3);
     nri::Buffer*& positionBuffer = m_OmmAlphaGeometryBuffers.emplace_back();
@@ -1255,7 +1413,7 @@ void Sample::InitAlphaTestedGeometry() {
 
     // raw data for uploading to gpu
     std::vector<uint8_t> positions;
-    std::vector<uint8_t> uvs;
+    std::vector<uint8_t> uvBytes;
     std::vector<uint8_t> indices;
 
     uint32_t storageAlignment = NRI.GetDeviceDesc(*m_Device).memoryAlignment.bufferShaderResourceOffset;
@@ -1273,19 +1431,15 @@ void Sample::InitAlphaTestedGeometry() {
         geometry.alphaTexture = materialTextures[material.baseColorTexIndex];
         geometry.utilsTexture = m_Scene.textures[material.baseColorTexIndex];
 
-        size_t uvDataSize = mesh.vertexNum * sizeof(float2);
-        geometry.uvData.resize(uvDataSize);
-
         size_t positionDataSize = mesh.vertexNum * sizeof(float3);
         geometry.positions = positionBuffer;
         geometry.positionOffset = positions.size();
         geometry.positionBufferSize = positionBufferSize;
         positions.resize(geometry.positionOffset + helper::Align(positionDataSize, bufferAlignment));
 
+        ommhelper::GetMeshUvRange(m_Scene, mesh, geometry.uvMin, geometry.uvMax);
         for (uint32_t y = 0; y < mesh.vertexNum; ++y) {
             uint32_t offset = mesh.vertexOffset + y;
-            memcpy(geometry.uvData.data() + y * sizeof(float2), m_Scene.unpackedVertices[offset].uv, sizeof(float2));
-
             float3 position = {
                 m_Scene.unpackedVertices[offset].pos[0],
                 m_Scene.unpackedVertices[offset].pos[1],
@@ -1296,21 +1450,19 @@ void Sample::InitAlphaTestedGeometry() {
             memcpy(dst, &position, positionStride);
         }
 
-        size_t indexDataSize = mesh.indexNum * sizeof(utils::Index);
-        geometry.indexData.resize(indexDataSize);
-        memcpy(geometry.indexData.data(), m_Scene.indices.data() + mesh.indexOffset, indexDataSize);
-
+        size_t indexDataSize = geometry.indexData.size();
         geometry.indices = indexBuffer;
         geometry.indexOffset = indices.size();
         geometry.indexBufferSize = indexBufferSize;
         indices.resize(geometry.indexOffset + helper::Align(indexDataSize, bufferAlignment));
-        memcpy(indices.data() + geometry.indexOffset, m_Scene.indices.data() + mesh.indexOffset, indexDataSize);
+        memcpy(indices.data() + geometry.indexOffset, geometry.indexData.data(), indexDataSize);
 
+        size_t uvDataSize = geometry.uvData.size();
         geometry.uvs = uvBuffer;
-        geometry.uvOffset = uvs.size();
+        geometry.uvOffset = uvBytes.size();
         geometry.uvBufferSize = uvBufferSize;
-        uvs.resize(geometry.uvOffset + helper::Align(uvDataSize, storageAlignment));
-        memcpy(uvs.data() + geometry.uvOffset, geometry.uvData.data(), uvDataSize);
+        uvBytes.resize(geometry.uvOffset + helper::Align(uvDataSize, storageAlignment));
+        memcpy(uvBytes.data() + geometry.uvOffset, geometry.uvData.data(), uvDataSize);
     }
 
     { // Bind memories
@@ -1326,7 +1478,7 @@ void Sample::InitAlphaTestedGeometry() {
         uploadDescs.push_back(desc);
 
         desc.buffer = uvBuffer;
-        desc.data = uvs.data();
+        desc.data = uvBytes.data();
         uploadDescs.push_back(desc);
 
         desc.buffer = indexBuffer;
@@ -1336,94 +1488,175 @@ void Sample::InitAlphaTestedGeometry() {
     NRI.UploadData(*m_GraphicsQueue, nullptr, 0, uploadDescs.data(), (uint32_t)uploadDescs.size());
 }
 
-void PreprocessAlphaTexture(detexTexture* texture, std::vector<uint8_t>& outAlphaChannel) {
-    uint8_t* pixels = texture->data;
-    std::vector<uint8_t> decompressedImage;
-    uint32_t format = texture->format;
-    { // Hack detex to decompress texture as BC1A to get alpha data
-        uint32_t originalFormat = texture->format;
-        if (originalFormat == DETEX_TEXTURE_FORMAT_BC1)
-            texture->format = DETEX_TEXTURE_FORMAT_BC1A;
-
-        if (detexFormatIsCompressed(texture->format)) {
-            uint32_t size = uint32_t(texture->width) * uint32_t(texture->height) * detexGetPixelSize(DETEX_PIXEL_FORMAT_RGBA8);
-            decompressedImage.resize(size);
-            detexDecompressTextureLinear(texture, &decompressedImage[0], DETEX_PIXEL_FORMAT_RGBA8);
-            pixels = &decompressedImage[0];
-            format = DETEX_PIXEL_FORMAT_RGBA8;
-        }
-        texture->format = originalFormat;
+constexpr uint32_t ALPHA_DECODE_TEXELS_PER_JOB = 1 << 18; // granularity of the alpha decode jobs, rounded to whole rows of 4x4 blocks
+
+inline bool AreBakerOutputsOnGPU(const ommhelper::OmmBakeGeometryDesc& instance) {
+    bool result = true;
+    for (uint32_t i = 0; i < (uint32_t)ommhelper::OmmDataLayout::CpuMaxNum; ++i)
+        result &= bool(instance.gpuBuffers[i].dataSize);
+    return result;
+}
+
+void Sample::LoadOmmMaterialOverrides() { // "<scene>.omm" next to the scene file, see ommhelper::LoadMaterialBakeParams()
+    std::string filename = utils::GetFullPath(m_SceneFile, utils::DataFolder::SCENES);
+    filename = filename.substr(0, filename.find_last_of('.')) + ".omm";
+    ommhelper::LoadMaterialBakeParams(filename.c_str(), (uint32_t)m_Scene.materials.size(), m_OmmMaterialOverrides);
+}
+
+void Sample::ResolveOmmGeometryBakeParams() { // per geometry params, levels and formats. Analytical, nothing is decoded or baked here. Called once per update
+    LoadOmmMaterialOverrides();
+    for (AlphaTestedGeometry& geometry : m_OmmAlphaGeometry) {
+        const ommhelper::OmmMaterialBakeParams& params = GetOmmMaterialBakeParams(geometry.materialIndex);
+        ommhelper::ResolveGeometryBakeParams(m_Scene, geometry.meshIndex, geometry.materialIndex, params, m_OmmBakeDesc, geometry.bakeDesc);
     }
 
-    uint32_t pixelSize = detexGetPixelSize(format);
-    uint32_t pixelCount = texture->width * texture->height;
-    outAlphaChannel.reserve(pixelCount);
+    if (m_OmmBakeDesc.enableAutoSubdivisionLevel && !m_OmmAlphaGeometry.empty()) {
+        uint32_t levelHistogram[16] = {};
+        for (const AlphaTestedGeometry& geometry : m_OmmAlphaGeometry)
+            ++levelHistogram[std::min(geometry.bakeDesc.maxSubdivisionLevel, 15u)];
 
-    for (uint32_t i = 0; i < pixelCount; ++i) {
-        uint32_t offset = i * pixelSize;
-        uint32_t alphaValue;
-        if (pixelSize == 4) {
-            uint32_t pixel = *(uint32_t*)(pixels + offset);
-            alphaValue = detexPixel32GetA8(pixel);
-        } else {
-            uint64_t pixel = *(uint64_t*)(pixels + offset);
-            alphaValue = (uint32_t)detexPixel64GetA16(pixel);
+        printf("[OMM] Auto subdivision levels:");
+        for (uint32_t level = 0; level < 16; ++level) {
+            if (levelHistogram[level])
+                printf(" [%u]: %u", level, levelHistogram[level]);
         }
-        outAlphaChannel.push_back(uint8_t(alphaValue));
+        printf("\n");
+    }
+
+    if (m_OmmBakeDesc.memoryBudgetMb)
+        ApplyOmmMemoryBudget();
+
+    for (AlphaTestedGeometry& geometry : m_OmmAlphaGeometry) { // bake descs are released after every pass, the resolved params outlive them
+        geometry.resolvedSubdivisionLevel = geometry.bakeDesc.maxSubdivisionLevel;
+        geometry.resolvedFormat = geometry.bakeDesc.format;
     }
 }
 
-inline bool AreBakerOutputsOnGPU(const ommhelper::OmmBakeGeometryDesc& instance) {
-    bool result = true;
-    for (uint32_t i = 0; i < (uint32_t)ommhelper::OmmDataLayout::CpuMaxNum; ++i)
-        result &= bool(instance.gpuBuffers[i].dataSize);
-    return result;
+uint32_t Sample::UpdateOmmGeometryDirtyState() { // a geometry is dirty if its effective inputs differ from the published ones. Params must be resolved already
+    ommhelper::OmmBakeDesc commonDesc = m_OmmBakeDesc; // global level and format only matter through the per geometry ones
+    commonDesc.subdivisionLevel = 0;
+    commonDesc.format = ommhelper::OmmFormats::OC1_4_STATE;
+    const uint64_t stateHash = ommhelper::OmmCaching::CalculateSateHash(commonDesc);
+
+    uint32_t dirtyNum = 0;
+    for (size_t id = 0; id < m_OmmAlphaGeometry.size(); ++id) {
+        AlphaTestedGeometry& geometry = m_OmmAlphaGeometry[id];
+        uint32_t inputs[2] = {GetOmmGeometrySubdivisionLevel(geometry), (uint32_t)geometry.resolvedFormat};
+
+        uint64_t hash = (stateHash ^ GetInstanceHash(geometry.meshIndex, geometry.materialIndex)) * 1099511628211ull; // scene meshes and textures are immutable
+        for (uint32_t input : inputs)
+            hash = (hash ^ input) * 1099511628211ull;
+
+        geometry.inputHash = hash ? hash : 1;
+        geometry.isDirty = geometry.inputHash != geometry.builtInputHash && (m_OmmUpdateFilter.empty() || m_OmmUpdateFilter[id]);
+        dirtyNum += geometry.isDirty;
+    }
+    return dirtyNum;
 }
 
 void Sample::FillOmmBakerInputs() {
-    std::map<uint64_t, size_t> materialMaskToTextureDataOffset;
+    UpdateOmmGeometryDirtyState();
+    for (AlphaTestedGeometry& geometry : m_OmmAlphaGeometry) {
+        ommhelper::SetRuntimeAlphaParams(geometry.bakeDesc);
+        geometry.bakeDesc.maxSubdivisionLevel = GetOmmGeometrySubdivisionLevel(geometry);
+        geometry.bakeDesc.format = geometry.resolvedFormat;
+    }
+
     if (m_OmmBakeDesc.type == ommhelper::OmmBakerType::CPU) { // Decompress textures and store alpha channel in a separate buffer for cpu baker
-        std::set<uint32_t> uniqueMaterialIds;
-        std::vector<uint8_t> workVector;
-        for (size_t i = 0; i < m_OmmAlphaGeometry.size(); ++i) { // Sort out unique textures to avoid resource duplication
+        ReleaseAlphaSources();
+        m_OmmAlphaStreamingBudget = size_t(m_OmmBakeDesc.alphaDecodeBudgetMb) << 20;
+
+        std::map<uint64_t, uint32_t> textureHashToAlphaSource; // materials aliasing the same pixels share decode work, memory and baker textures
+        for (size_t i = 0; i < m_OmmAlphaGeometry.size(); ++i) {
             AlphaTestedGeometry& geometry = m_OmmAlphaGeometry[i];
-            ommhelper::InputTexture& bakerTexure = geometry.bakeDesc.texture;
-            uint32_t materialId = geometry.materialIndex;
+            if (!geometry.isDirty)
+                continue;
 
-            const utils::Material& material = m_Scene.materials[materialId];
+            ommhelper::InputTexture& bakerTexure = geometry.bakeDesc.texture;
+            const utils::Material& material = m_Scene.materials[geometry.materialIndex];
             utils::Texture* utilsTexture = m_Scene.textures[material.baseColorTexIndex];
 
-            uint32_t minMip = utilsTexture->GetMipNum() - 1;
-            uint32_t textureMipOffset = m_OmmBakeDesc.mipBias > minMip ? minMip : m_OmmBakeDesc.mipBias;
-            uint32_t remainingMips = minMip - textureMipOffset + 1;
-            uint32_t mipRange = m_OmmBakeDesc.mipCount > remainingMips ? remainingMips : m_OmmBakeDesc.mipCount;
+            uint32_t textureMipOffset = 0;
+            uint32_t mipRange = 0;
+            ommhelper::GetAlphaMipRange(utilsTexture, m_OmmBakeDesc, textureMipOffset, mipRange);
 
             bakerTexure.mipOffset = textureMipOffset;
             bakerTexure.mipNum = mipRange;
 
-            size_t uniqueMaterialsNum = uniqueMaterialIds.size();
-            uniqueMaterialIds.insert(materialId);
-            if (uniqueMaterialsNum == uniqueMaterialIds.size())
-                continue; // duplication
+            uint64_t textureHash = GetAlphaTextureContentHash(material.baseColorTexIndex, textureMipOffset, mipRange);
 
-            for (uint32_t mip = 0; mip < mipRange; ++mip) {
-                uint32_t mipId = textureMipOffset + mip;
-                detexTexture* texture = (detexTexture*)utilsTexture->mips[mipId];
+            const auto& it = textureHashToAlphaSource.find(textureHash);
+            bool isShared = false;
+            if (it != textureHashToAlphaSource.end()) {
+                const AlphaSource& candidate = m_OmmAlphaSources[it->second];
+                isShared = candidate.mipNum == mipRange && ommhelper::IsSameAlphaPayload(candidate.texture, candidate.mipOffset, utilsTexture, textureMipOffset, mipRange);
+            }
+
+            geometry.alphaSourceIndex = isShared ? it->second : (uint32_t)m_OmmAlphaSources.size();
+            if (!isShared) {
+                if (it == textureHashToAlphaSource.end())
+                    textureHashToAlphaSource.insert(std::make_pair(textureHash, geometry.alphaSourceIndex));
+
+                AlphaSource source = {};
+                source.texture = utilsTexture;
+                source.textureIndex = material.baseColorTexIndex;
+                source.mipOffset = textureMipOffset;
+                source.mipNum = mipRange;
+                memcpy(source.uvMin, geometry.uvMin, sizeof(source.uvMin));
+                memcpy(source.uvMax, geometry.uvMax, sizeof(source.uvMax));
+                m_OmmAlphaSources.push_back(std::move(source));
+            }
 
-                PreprocessAlphaTexture(texture, workVector);
+            AlphaSource& source = m_OmmAlphaSources[geometry.alphaSourceIndex];
+            source.lastGeometryIndex = (uint32_t)i;
+            for (uint32_t axis = 0; axis < 2; ++axis) { // only the uv-referenced part of each texture gets decoded
+                source.uvMin[axis] = std::min(source.uvMin[axis], geometry.uvMin[axis]);
+                source.uvMax[axis] = std::max(source.uvMax[axis], geometry.uvMax[axis]);
+            }
+        }
 
-                size_t rawBufferOffset = m_OmmRawAlphaChannelForCpuBaker.size();
-                m_OmmRawAlphaChannelForCpuBaker.insert(m_OmmRawAlphaChannelForCpuBaker.end(), workVector.begin(), workVector.end());
-                materialMaskToTextureDataOffset.insert(std::make_pair(uint64_t(materialId) << 32 | uint64_t(mipId), rawBufferOffset));
-                workVector.clear();
+        m_OmmAlphaDecodePendingJobs = std::vector<std::atomic<uint32_t>>(m_OmmAlphaSources.size());
+        for (AlphaSource& source : m_OmmAlphaSources) {
+            source.crop = ommhelper::GetAlphaCrop(source.uvMin, source.uvMax, source.texture, source.mipOffset, source.mipNum);
+
+            for (uint32_t mip = 0; mip < source.mipNum; ++mip) {
+                uint32_t mipId = source.mipOffset + mip;
+                detexTexture* texture = (detexTexture*)source.texture->mips[mipId];
+
+                ommhelper::AlphaRegion region = ommhelper::GetAlphaRegion(source.crop, texture, mipId);
+                size_t regionSize = size_t(region.width) * size_t(region.height);
+                source.regions[mip] = region;
+                if (m_OmmBakeDesc.enableCache) { // decoded alpha is mapped straight from disk on hit
+                    uint64_t contentHash = GetAlphaMipContentHash(source.textureIndex, mipId);
+                    if (ommhelper::IsAlphaCropped(source.crop)) {
+                        const int32_t regionRect[] = {region.x, region.y, int32_t(region.width), int32_t(region.height)};
+                        contentHash = HashBytes(regionRect, sizeof(regionRect), contentHash);
+                    }
+
+                    source.mipData[mip] = ommhelper::AlphaMipCache::MapAlphaMip(GetOmmAlphaCacheFolderName().c_str(), contentHash, ommhelper::GetAlphaMipSourceDesc(texture), regionSize);
+                    source.isMipMapped[mip] = source.mipData[mip] != nullptr;
+                    if (source.isMipMapped[mip])
+                        continue;
+                    source.mipCacheKeys[mip] = contentHash;
+                }
+                source.decodedSize += regionSize;
             }
         }
+
+        if (m_OmmAlphaStreamingBudget == 0) {
+            for (uint32_t sourceId = 0; sourceId < (uint32_t)m_OmmAlphaSources.size(); ++sourceId)
+                MakeAlphaSourceResident(sourceId);
+            LaunchAlphaDecode(); // sources follow geometry order, so baking of the first geometries can start while the rest is being decoded
+        }
     }
 
     for (size_t i = 0; i < m_OmmAlphaGeometry.size(); ++i) { // Fill baking queue desc
         bool isGpuBaker = m_OmmBakeDesc.type == ommhelper::OmmBakerType::GPU;
 
         AlphaTestedGeometry& geometry = m_OmmAlphaGeometry[i];
+        if (!geometry.isDirty)
+            continue;
+
         ommhelper::OmmBakeGeometryDesc& ommDesc = geometry.bakeDesc;
         const utils::Mesh& mesh = m_Scene.meshes[geometry.meshIndex];
         const utils::Material& material = m_Scene.materials[geometry.materialIndex];
@@ -1448,41 +1681,235 @@ void Sample::FillOmmBakerInputs() {
             ommDesc.indices.nriBufferOrPtr.ptr = (void*)geometry.indexData.data();
             ommDesc.uvs.nriBufferOrPtr.ptr = (void*)geometry.uvData.data();
 
-            for (uint32_t mip = 0; mip < bakerTexture.mipNum; ++mip) {
-                uint32_t mipId = bakerTexture.mipOffset + mip;
-                uint64_t materialMask = uint64_t(geometry.materialIndex) << 32 | uint64_t(mipId);
-                size_t texDataOffset = materialMaskToTextureDataOffset.find(materialMask)->second;
+            const AlphaSource& source = m_OmmAlphaSources[geometry.alphaSourceIndex];
+            geometry.croppedUvFormat = geometry.uvFormat;
+            if (ommhelper::IsAlphaCropped(source.crop)) {
+                geometry.croppedUvFormat = ommhelper::RemapUvsToAlphaCrop(source.crop, m_Scene.unpackedVertices.data() + mesh.vertexOffset, mesh.vertexNum, geometry.croppedUvData);
+                ommDesc.uvs.nriBufferOrPtr.ptr = (void*)geometry.croppedUvData.data();
+            }
 
+            for (uint32_t mip = 0; mip < bakerTexture.mipNum; ++mip) {
                 ommhelper::MipDesc& mipDesc = ommDesc.texture.mips[mip];
-                mipDesc.nriTextureOrPtr.ptr = (void*)(m_OmmRawAlphaChannelForCpuBaker.data() + texDataOffset);
-                mipDesc.width = reinterpret_cast<detexTexture*>(utilsTexture->mips[mipId])->width;
-                mipDesc.height = reinterpret_cast<detexTexture*>(utilsTexture->mips[mipId])->height;
+                mipDesc.nriTextureOrPtr.ptr = (void*)source.mipData[mip]; // set later by StreamAlphaSources() if the source is not resident yet
+                mipDesc.width = source.regions[mip].width;
+                mipDesc.height = source.regions[mip].height;
             }
         }
 
+        nri::Format uvFormat = isGpuBaker ? geometry.uvFormat : geometry.croppedUvFormat;
         ommDesc.indices.numElements = mesh.indexNum;
-        ommDesc.indices.stride = sizeof(utils::Index);
-        ommDesc.indices.format = nri::Format::R32_UINT;
+        ommDesc.indices.stride = ommhelper::GetOmmIndexStride(geometry.indexFormat);
+        ommDesc.indices.format = geometry.indexFormat;
         ommDesc.indices.offset = geometry.indexOffset;
         ommDesc.indices.bufferSize = geometry.indexBufferSize;
         ommDesc.indices.offsetInStruct = 0;
 
         ommDesc.uvs.numElements = mesh.vertexNum;
-        ommDesc.uvs.stride = sizeof(float2);
-        ommDesc.uvs.format = nri::Format::RG32_SFLOAT;
+        ommDesc.uvs.stride = ommhelper::GetOmmUvStride(uvFormat);
+        ommDesc.uvs.format = uvFormat;
         ommDesc.uvs.offset = geometry.uvOffset;
         ommDesc.uvs.bufferSize = geometry.uvBufferSize;
         ommDesc.uvs.offsetInStruct = 0;
 
         ommDesc.texture.format = isGpuBaker ? utilsTexture->format : nri::Format::R8_UNORM;
-        ommDesc.texture.addressingMode = nri::AddressMode::REPEAT;
-        ommDesc.texture.alphaChannelId = 3;
-        ommDesc.alphaCutoff = 0.5f;
-        ommDesc.borderAlpha = 0.0f;
-        ommDesc.alphaMode = ommhelper::OmmAlphaMode::Test;
     }
 }
 
+void Sample::MakeAlphaSourceResident(uint32_t alphaSourceIndex) { // decode jobs are only queued here, LaunchAlphaDecode() starts them
+    AlphaSource& source = m_OmmAlphaSources[alphaSourceIndex];
+    source.decodedAlpha.resize(source.decodedSize);
+    source.isResident = true;
+    m_OmmAlphaResidentSize += source.decodedSize;
+
+    size_t offset = 0;
+    for (uint32_t mip = 0; mip < source.mipNum; ++mip) {
+        if (source.isMipMapped[mip])
+            continue;
+
+        detexTexture* texture = (detexTexture*)source.texture->mips[source.mipOffset + mip];
+        const ommhelper::AlphaRegion& region = source.regions[mip];
+        uint8_t* outAlpha = source.decodedAlpha.data() + offset;
+        uint32_t rowsPerJob = std::max((ALPHA_DECODE_TEXELS_PER_JOB / region.width) & ~3u, 4u); // whole block rows per job
+        for (uint32_t row = 0; row < region.height; row += rowsPerJob) {
+            m_OmmAlphaDecodeJobs.push_back({texture, region, outAlpha, row, std::min(row + rowsPerJob, region.height), alphaSourceIndex});
+            ++m_OmmAlphaDecodePendingJobs[alphaSourceIndex];
+        }
+
+        source.mipData[mip] = outAlpha;
+        offset += size_t(region.width) * size_t(region.height);
+    }
+}
+
+void Sample::ReleaseAlphaSource(uint32_t alphaSourceIndex) { // decode jobs of the source must be complete or abandoned
+    AlphaSource& source = m_OmmAlphaSources[alphaSourceIndex];
+    if (!source.isResident)
+        return;
+
+    bool isDecoded = m_OmmAlphaDecodePendingJobs[alphaSourceIndex].load(std::memory_order_acquire) == 0; // jobs abandoned on cancel leave mips partially decoded, those are not stored
+    m_OmmAlphaDecodePendingJobs[alphaSourceIndex].store(0, std::memory_order_relaxed);
+
+    m_OmmHelper.ReleaseCpuBakerTextures(source.mipData[0]);
+    for (uint32_t mip = 0; mip < source.mipNum; ++mip) {
+        if (source.isMipMapped[mip])
+            continue;
+
+        if (source.mipCacheKeys[mip] && isDecoded) { // stored once, even if the source gets decoded again later
+            const ommhelper::AlphaRegion& region = source.regions[mip];
+            ommhelper::AlphaMipCache::SourceDesc sourceDesc = ommhelper::GetAlphaMipSourceDesc((const detexTexture*)source.texture->mips[source.mipOffset + mip]);
+            ommhelper::OmmCaching::CreateFolder(m_OmmCacheFolderName.c_str());
+            ommhelper::OmmCaching::CreateFolder(GetOmmAlphaCacheFolderName().c_str());
+            ommhelper::AlphaMipCache::SaveAlphaMip(GetOmmAlphaCacheFolderName().c_str(), source.mipCacheKeys[mip], sourceDesc, source.mipData[mip], size_t(region.width) * size_t(region.height));
+            source.mipCacheKeys[mip] = 0;
+        }
+        source.mipData[mip] = nullptr;
+    }
+
+    m_OmmAlphaResidentSize -= source.decodedSize;
+    std::vector<uint8_t>().swap(source.decodedAlpha);
+    source.isResident = false;
+}
+
+void Sample::ReleaseAlphaSources() {
+    JoinAlphaDecodeWorkers();
+    for (uint32_t sourceId = 0; sourceId < (uint32_t)m_OmmAlphaSources.size(); ++sourceId)
+        ReleaseAlphaSource(sourceId);
+
+    m_OmmAlphaSources.clear();
+    m_OmmAlphaDecodePendingJobs.clear();
+    m_OmmAlphaResidentSize = 0;
+}
+
+void Sample::StreamAlphaSources(const OmmBatch& batch) { // makes alpha of the batch resident within the budget and prefetches the next source
+    JoinAlphaDecodeWorkers(); // previous prefetch is complete past this point
+
+    ++m_OmmAlphaUseTick;
+    std::set<uint32_t> batchSources;
+    for (size_t id = batch.offset; id < batch.offset + batch.count; ++id) {
+        if (m_OmmAlphaGeometry[id].isDirty)
+            batchSources.insert(m_OmmAlphaGeometry[id].alphaSourceIndex);
+    }
+
+    for (uint32_t sourceId : batchSources) {
+        AlphaSource& source = m_OmmAlphaSources[sourceId];
+        source.lastUseTick = m_OmmAlphaUseTick;
+        if (source.isResident)
+            continue;
+
+        while (m_OmmAlphaResidentSize + source.decodedSize > m_OmmAlphaStreamingBudget) { // evict least recently used sources
+            uint32_t lruSourceId = uint32_t(-1);
+            for (uint32_t residentId = 0; residentId < (uint32_t)m_OmmAlphaSources.size(); ++residentId) {
+                const AlphaSource& resident = m_OmmAlphaSources[residentId];
+                if (!resident.isResident || batchSources.count(residentId))
+                    continue;
+                if (lruSourceId == uint32_t(-1) || resident.lastUseTick < m_OmmAlphaSources[lruSourceId].lastUseTick)
+                    lruSourceId = residentId;
+            }
+
+            if (lruSourceId == uint32_t(-1))
+                break; // the batch alone exceeds the budget
+            ReleaseAlphaSource(lruSourceId);
+        }
+        MakeAlphaSourceResident(sourceId);
+    }
+
+    for (size_t id = batch.offset + batch.count; id < m_OmmAlphaGeometry.size(); ++id) { // decoding of the next source overlaps with baking of this batch
+        if (!m_OmmAlphaGeometry[id].isDirty)
+            continue;
+
+        uint32_t sourceId = m_OmmAlphaGeometry[id].alphaSourceIndex;
+        AlphaSource& source = m_OmmAlphaSources[sourceId];
+        if (source.isResident)
+            continue;
+
+        if (m_OmmAlphaResidentSize + source.decodedSize <= m_OmmAlphaStreamingBudget) {
+            source.lastUseTick = m_OmmAlphaUseTick;
+            MakeAlphaSourceResident(sourceId);
+        }
+        break;
+    }
+
+    LaunchAlphaDecode();
+    for (uint32_t sourceId : batchSources)
+        WaitForAlphaDecode(sourceId);
+
+    for (size_t id = batch.offset; id < batch.offset + batch.count; ++id) { // decoded data moves every time a source becomes resident
+        AlphaTestedGeometry& geometry = m_OmmAlphaGeometry[id];
+        if (!geometry.isDirty)
+            continue;
+
+        const AlphaSource& source = m_OmmAlphaSources[geometry.alphaSourceIndex];
+        for (uint32_t mip = 0; mip < source.mipNum; ++mip)
+            geometry.bakeDesc.texture.mips[mip].nriTextureOrPtr.ptr = (void*)source.mipData[mip];
+    }
+}
+
+void Sample::ReleaseUnusedAlphaSources(const OmmBatch& batch) {
+    for (size_t id = batch.offset; id < batch.offset + batch.count; ++id) {
+        if (!m_OmmAlphaGeometry[id].isDirty)
+            continue;
+
+        uint32_t sourceId = m_OmmAlphaGeometry[id].alphaSourceIndex;
+        if (m_OmmAlphaSources[sourceId].lastGeometryIndex < batch.offset + batch.count)
+            ReleaseAlphaSource(sourceId);
+    }
+}
+
+void Sample::LaunchAlphaDecode() {
+    m_OmmAlphaDecodeNextJob = 0;
+    size_t workerNum = std::min<size_t>(m_OmmAlphaDecodeJobs.size(), std::max(std::thread::hardware_concurrency(), 1u));
+    for (size_t i = 0; i < workerNum; ++i)
+        m_OmmAlphaDecodeWorkers.push_back(std::async(std::launch::async, [this]() {
+            while (RunNextAlphaDecodeJob())
+                ;
+        }));
+}
+
+bool Sample::RunNextAlphaDecodeJob() {
+    if (IsOmmBakeCancelled())
+        return false;
+
+    size_t jobId = m_OmmAlphaDecodeNextJob.fetch_add(1);
+    if (jobId >= m_OmmAlphaDecodeJobs.size())
+        return false;
+
+    const AlphaDecodeJob& job = m_OmmAlphaDecodeJobs[jobId];
+    ommhelper::DecodeAlphaRows(job.texture, job.region, job.outAlpha, job.rowBegin, job.rowEnd);
+    m_OmmAlphaDecodePendingJobs[job.alphaSourceIndex].fetch_sub(1, std::memory_order_release);
+    return true;
+}
+
+void Sample::WaitForAlphaDecode(uint32_t alphaSourceIndex) { // the caller helps with the remaining jobs instead of idling
+    while (m_OmmAlphaDecodePendingJobs[alphaSourceIndex].load(std::memory_order_acquire) != 0 && !IsOmmBakeCancelled()) {
+        if (!RunNextAlphaDecodeJob())
+            std::this_thread::yield();
+    }
+}
+
+void Sample::JoinAlphaDecodeWorkers() {
+    for (std::future<void>& worker : m_OmmAlphaDecodeWorkers)
+        worker.wait();
+    m_OmmAlphaDecodeWorkers.clear();
+    m_OmmAlphaDecodeJobs.clear();
+}
+
+uint64_t Sample::GetAlphaMipContentHash(uint32_t textureIndex, uint32_t mipId) {
+    uint64_t textureMask = uint64_t(textureIndex) << 32 | uint64_t(mipId);
+    const auto& it = m_OmmAlphaMipContentHashes.find(textureMask);
+    if (it != m_OmmAlphaMipContentHashes.end())
+        return it->second;
+
+    uint64_t contentHash = ommhelper::CalculateAlphaMipContentHash((const detexTexture*)m_Scene.textures[textureIndex]->mips[mipId]);
+    m_OmmAlphaMipContentHashes.insert(std::make_pair(textureMask, contentHash));
+    return contentHash;
+}
+
+uint64_t Sample::GetAlphaTextureContentHash(uint32_t textureIndex, uint32_t mipOffset, uint32_t mipNum) {
+    uint64_t mipContentHashes[OMM_MAX_MIP_NUM] = {};
+    for (uint32_t mip = 0; mip < mipNum; ++mip)
+        mipContentHashes[mip] = GetAlphaMipContentHash(textureIndex, mipOffset + mip);
+    return ommhelper::CalculateAlphaTextureContentHash(mipContentHashes, mipNum);
+}
+
 void PrepareOmmUsageCountsBuffers(ommhelper::OpacityMicroMapsHelper& ommHelper, ommhelper::OmmBakeGeometryDesc& desc) { // Sanitize baker outputed usageCounts buffers to fit GAPI format
     uint32_t usageCountBuffers[] = {(uint32_t)ommhelper::OmmDataLayout::DescArrayHistogram, (uint32_t)ommhelper::OmmDataLayout::IndexHistogram};
 
@@ -1520,6 +1947,9 @@ void Sample::FillOmmBlasBuildQueue(const OmmBatch& batch, std::vector<ommhelper:
     size_t uploadBufferOffset = m_OmmCpuUploadBuffers.size();
     for (size_t id = batch.offset; id < batch.offset + batch.count; ++id) {
         AlphaTestedGeometry& geometry = m_OmmAlphaGeometry[id];
+        if (!geometry.isDirty)
+            continue;
+
         ommhelper::OmmBakeGeometryDesc& bakeResult = geometry.bakeDesc;
         ommhelper::MaskedGeometryBuildDesc& buildDesc = geometry.buildDesc;
         const utils::Mesh& mesh = m_Scene.meshes[geometry.meshIndex];
@@ -1663,6 +2093,238 @@ OmmGpuBakerPrebuildMemoryStats Sample::GetGpuBakerPrebuildMemoryStats(bool print
     return result;
 }
 
+uint32_t PredictOmmSubdivisionLevel(float texelArea, uint32_t maxSubdivisionLevel, float dynamicSubdivisionScale) { // mirrors dynamic subdivision of the bakers: micro-triangles of about dynamicSubdivisionScale texels
+    if (texelArea <= 0.0f) // degenerate, gets a special index
+        return 0;
+    if (dynamicSubdivisionScale <= 0.0f)
+        return maxSubdivisionLevel;
+
+    float scaledArea = texelArea / (dynamicSubdivisionScale * dynamicSubdivisionScale);
+    float level = std::ceil(0.5f * std::log2(std::max(scaledArea, 1.0f)));
+    return std::min((uint32_t)level, maxSubdivisionLevel);
+}
+
+OmmGpuBakerPrebuildMemoryStats Sample::PredictOmmOutputSizes(bool printStats) { // analytical, no special indices or deduplication assumed. Works for both bakers before anything is baked
+    const uint32_t arrayDataId = (uint32_t)ommhelper::OmmDataLayout::ArrayData;
+    const uint32_t descArrayId = (uint32_t)ommhelper::OmmDataLayout::DescArray;
+    const uint32_t indicesId = (uint32_t)ommhelper::OmmDataLayout::Indices;
+    const bool isCpuBaker = m_OmmBakeDesc.type == ommhelper::OmmBakerType::CPU;
+    const bool force32bitIndices = isCpuBaker ? m_OmmBakeDesc.cpuFlags.force32bitIndices : m_OmmBakeDesc.gpuFlags.force32bitIndices;
+
+    OmmGpuBakerPrebuildMemoryStats result = {};
+    for (AlphaTestedGeometry& geometry : m_OmmAlphaGeometry) {
+        uint64_t arrayDataSize = 0;
+        uint32_t triangleNum = m_Scene.meshes[geometry.meshIndex].indexNum / 3;
+        uint32_t maxSubdivisionLevel = geometry.bakeDesc.maxSubdivisionLevel;
+        size_t bitsPerState = geometry.bakeDesc.format == ommhelper::OmmFormats::OC1_2_STATE ? 1 : 2;
+        ommhelper::ForEachUvTriangleTexelArea(m_Scene, geometry.meshIndex, geometry.materialIndex, m_OmmBakeDesc.mipBias, [&](float texelArea) {
+            uint32_t level = PredictOmmSubdivisionLevel(texelArea, maxSubdivisionLevel, m_OmmBakeDesc.dynamicSubdivisionScale);
+            arrayDataSize += ((uint64_t(1) << (2 * level)) * bitsPerState + 7) / 8;
+        });
+
+        bool is16bit = !force32bitIndices && triangleNum <= uint32_t(std::numeric_limits<int16_t>::max());
+        geometry.predictedSizes[arrayDataId] = arrayDataSize;
+        geometry.predictedSizes[descArrayId] = uint64_t(triangleNum) * sizeof(ommCpuOpacityMicromapDesc);
+        geometry.predictedSizes[indicesId] = uint64_t(triangleNum) * (is16bit ? sizeof(int16_t) : sizeof(int32_t));
+
+        for (uint32_t y = 0; y < (uint32_t)ommhelper::OmmDataLayout::BlasBuildGpuBuffersNum; ++y) {
+            result.outputTotalSizes[y] += geometry.predictedSizes[y];
+            result.outputMaxSizes[y] = std::max<size_t>(geometry.predictedSizes[y], result.outputMaxSizes[y]);
+            result.total += geometry.predictedSizes[y];
+        }
+    }
+
+    if (printStats) {
+        const OmmPredictionCalibration& calibration = GetOmmPredictionCalibration();
+        auto toMb = [](double sizeInBytes) -> double { return sizeInBytes / 1024.0 / 1024.0; };
+        const char* names[] = {"ArrayData", "DescArray", "Indices"};
+        printf("\n[OMM][%s] Predicted Output Stats:\n", isCpuBaker ? "CPU" : "GPU");
+        printf("Predicted output memory (mb): (total)%.3f\n", toMb(double(result.total)));
+        for (uint32_t y = 0; y < (uint32_t)ommhelper::OmmDataLayout::BlasBuildGpuBuffersNum; ++y) {
+            double predicted = double(result.outputTotalSizes[y]);
+            if (calibration.sampleNum)
+                printf("Predicted %sSize(mb): %.3f, calibrated over %u geometries: [%.3f - %.3f]\n", names[y], toMb(predicted), calibration.sampleNum, toMb(predicted * calibration.ratioMin[y]), toMb(predicted * calibration.ratioMax[y]));
+            else
+                printf("Predicted %sSize(mb): %.3f (upper estimate)\n", names[y], toMb(predicted));
+        }
+    }
+    return result;
+}
+
+void Sample::CalibrateOmmOutputPrediction(const OmmBatch& batch) { // geometries without host side outputs (gpu baker without cache) don't contribute
+    OmmPredictionCalibration& calibration = GetOmmPredictionCalibration();
+    for (size_t id = batch.offset; id < batch.offset + batch.count; ++id) {
+        const AlphaTestedGeometry& geometry = m_OmmAlphaGeometry[id];
+        const ommhelper::OmmBakeGeometryDesc& bakeResult = geometry.bakeDesc;
+        if (bakeResult.outData[(uint32_t)ommhelper::OmmDataLayout::Indices].empty())
+            continue;
+
+        for (uint32_t y = 0; y < (uint32_t)ommhelper::OmmDataLayout::BlasBuildGpuBuffersNum; ++y) {
+            if (geometry.predictedSizes[y] == 0)
+                continue;
+
+            double ratio = double(bakeResult.outData[y].size()) / double(geometry.predictedSizes[y]);
+            calibration.ratioMin[y] = calibration.sampleNum ? std::min(calibration.ratioMin[y], ratio) : ratio;
+            calibration.ratioMax[y] = calibration.sampleNum ? std::max(calibration.ratioMax[y], ratio) : ratio;
+        }
+        ++calibration.sampleNum;
+    }
+}
+
+struct OmmBudgetOption {
+    uint64_t size;
+    double value;
+    uint32_t subdivisionLevel;
+    ommhelper::OmmFormats format;
+};
+
+void Sample::ApplyOmmMemoryBudget() { // greedy knapsack: per geometry (level, format) upgrades with the best value per predicted byte go first
+    const uint32_t arrayDataId = (uint32_t)ommhelper::OmmDataLayout::ArrayData;
+    const uint32_t descArrayId = (uint32_t)ommhelper::OmmDataLayout::DescArray;
+    const uint32_t indicesId = (uint32_t)ommhelper::OmmDataLayout::Indices;
+    const bool isCpuBaker = m_OmmBakeDesc.type == ommhelper::OmmBakerType::CPU;
+    const bool force32bitIndices = isCpuBaker ? m_OmmBakeDesc.cpuFlags.force32bitIndices : m_OmmBakeDesc.gpuFlags.force32bitIndices;
+    const uint64_t budget = uint64_t(m_OmmBakeDesc.memoryBudgetMb) << 20;
+
+    const OmmPredictionCalibration& calibration = GetOmmPredictionCalibration();
+    double sizeScales[(uint32_t)ommhelper::OmmDataLayout::BlasBuildGpuBuffersNum]; // calibrated by the worst ratio seen so far with these settings, the raw prediction is an upper estimate
+    for (uint32_t y = 0; y < (uint32_t)ommhelper::OmmDataLayout::BlasBuildGpuBuffersNum; ++y)
+        sizeScales[y] = calibration.sampleNum ? calibration.ratioMax[y] : 1.0;
+
+    std::map<uint64_t, uint32_t> instanceNums;
+    for (const utils::Instance& instance : m_Scene.instances)
+        ++instanceNums[GetInstanceHash(instance.meshInstanceIndex, instance.materialIndex)];
+
+    // Options of each geometry reduced to the upper convex hull of (size, value), so every next step has a lower value per byte
+    std::vector<std::vector<OmmBudgetOption>> hulls(m_OmmAlphaGeometry.size());
+    for (size_t id = 0; id < m_OmmAlphaGeometry.size(); ++id) {
+        const AlphaTestedGeometry& geometry = m_OmmAlphaGeometry[id];
+        const uint32_t maxSubdivisionLevel = geometry.bakeDesc.maxSubdivisionLevel;
+        const uint32_t triangleNum = m_Scene.meshes[geometry.meshIndex].indexNum / 3;
+
+        std::vector<uint64_t> arrayDataSizes[2] = {std::vector<uint64_t>(maxSubdivisionLevel + 1), std::vector<uint64_t>(maxSubdivisionLevel + 1)}; // [bitsPerState - 1][level]
+        double texelArea = 0.0;
+        ommhelper::ForEachUvTriangleTexelArea(m_Scene, geometry.meshIndex, geometry.materialIndex, m_OmmBakeDesc.mipBias, [&](float triangleTexelArea) {
+            texelArea += triangleTexelArea;
+            for (uint32_t level = 1; level <= maxSubdivisionLevel; ++level) {
+                uint64_t microTriangleNum = uint64_t(1) << (2 * PredictOmmSubdivisionLevel(triangleTexelArea, level, m_OmmBakeDesc.dynamicSubdivisionScale));
+                arrayDataSizes[0][level] += (microTriangleNum + 7) / 8;
+                arrayDataSizes[1][level] += (microTriangleNum * 2 + 7) / 8;
+            }
+        });
+
+        bool is16bit = !force32bitIndices && triangleNum <= uint32_t(std::numeric_limits<int16_t>::max());
+        double fixedSize = double(triangleNum) * sizeof(ommCpuOpacityMicromapDesc) * sizeScales[descArrayId];
+        fixedSize += double(triangleNum) * (is16bit ? sizeof(int16_t) : sizeof(int32_t)) * sizeScales[indicesId];
+        double weight = texelArea * instanceNums[GetInstanceHash(geometry.meshIndex, geometry.materialIndex)];
+
+        std::vector<ommhelper::OmmFormats> formats = {geometry.bakeDesc.format};
+        if (geometry.bakeDesc.format == ommhelper::OmmFormats::OC1_4_STATE)
+            formats.push_back(ommhelper::OmmFormats::OC1_2_STATE);
+
+        std::vector<OmmBudgetOption> options;
+        for (ommhelper::OmmFormats format : formats) {
+            bool isTwoState = format == ommhelper::OmmFormats::OC1_2_STATE;
+            double formatValue = format == geometry.bakeDesc.format ? 1.0 : OMM_BUDGET_TWO_STATE_VALUE;
+            for (uint32_t level = 1; level <= maxSubdivisionLevel; ++level) {
+                OmmBudgetOption option = {};
+                option.size = uint64_t(fixedSize + double(arrayDataSizes[isTwoState ? 0 : 1][level]) * sizeScales[arrayDataId]);
+                option.value = weight * formatValue * (1.0 - std::exp2(-double(level))); // unknown micro-triangles follow alpha edges: their share halves per level
+                option.subdivisionLevel = level;
+                option.format = format;
+                options.push_back(option);
+            }
+        }
+        std::sort(options.begin(), options.end(), [](const OmmBudgetOption& a, const OmmBudgetOption& b) { return a.size != b.size ? a.size < b.size : a.value > b.value; });
+
+        auto slope = [](const OmmBudgetOption& from, const OmmBudgetOption& to) { return (to.value - from.value) / double(std::max<uint64_t>(to.size - from.size, 1)); };
+        std::vector<OmmBudgetOption>& hull = hulls[id];
+        for (const OmmBudgetOption& option : options) {
+            if (!hull.empty() && option.value <= hull.back().value)
+                continue;
+            while (hull.size() >= 2 && slope(hull[hull.size() - 2], hull.back()) <= slope(hull.back(), option))
+                hull.pop_back();
+            hull.push_back(option);
+        }
+    }
+
+    uint64_t total = 0;
+    std::vector<size_t> choices(m_OmmAlphaGeometry.size(), 0);
+    std::priority_queue<std::pair<double, size_t>> upgrades; // value per byte of the next hull step -> geometry
+    for (size_t id = 0; id < hulls.size(); ++id) {
+        total += hulls[id][0].size;
+        if (hulls[id].size() > 1)
+            upgrades.push(std::make_pair((hulls[id][1].value - hulls[id][0].value) / double(std::max<uint64_t>(hulls[id][1].size - hulls[id][0].size, 1)), id));
+    }
+
+    while (!upgrades.empty()) {
+        size_t id = upgrades.top().second;
+        upgrades.pop();
+
+        const std::vector<OmmBudgetOption>& hull = hulls[id];
+        size_t next = choices[id] + 1;
+        uint64_t extraSize = hull[next].size - hull[choices[id]].size;
+        if (total + extraSize > budget) // later steps of this geometry are even larger
+            continue;
+
+        total += extraSize;
+        choices[id] = next;
+        if (next + 1 < hull.size())
+            upgrades.push(std::make_pair((hull[next + 1].value - hull[next].value) / double(std::max<uint64_t>(hull[next + 1].size - hull[next].size, 1)), id));
+    }
+
+    uint32_t reducedNum = 0;
+    for (size_t id = 0; id < m_OmmAlphaGeometry.size(); ++id) {
+        ommhelper::OmmBakeGeometryDesc& bakeDesc = m_OmmAlphaGeometry[id].bakeDesc;
+        const OmmBudgetOption& option = hulls[id][choices[id]];
+        reducedNum += option.subdivisionLevel != bakeDesc.maxSubdivisionLevel || option.format != bakeDesc.format;
+        bakeDesc.maxSubdivisionLevel = option.subdivisionLevel;
+        bakeDesc.format = option.format;
+    }
+    m_OmmBudgetPredictedSize.store(total, std::memory_order_relaxed);
+
+    auto toMb = [](uint64_t sizeInBytes) -> double { return double(sizeInBytes) / 1024.0 / 1024.0; };
+    printf("[OMM] Memory budget: %.3f of %.3f mb predicted, %u of %zu geometries reduced%s\n", toMb(total), toMb(budget), reducedNum, m_OmmAlphaGeometry.size(), total > budget ? " (coarsest options exceed the budget)" : "");
+}
+
+std::vector<OmmBatch> GetCpuBakerBatches(const std::vector<AlphaTestedGeometry>& geometries, const std::vector<AlphaSource>& alphaSources, const uint64_t batchOutputSize, const size_t alphaBudget, bool keepSourcesTogether) { // based on predicted output sizes. Alpha of a batch must fit into the streaming budget, if any
+    std::vector<OmmBatch> batches;
+    std::set<uint32_t> batchSources;
+    uint64_t accumulation = 0;
+    size_t alphaAccumulation = 0;
+    uint32_t lastSourceIndex = uint32_t(-1);
+    for (size_t i = 0; i < geometries.size(); ++i) {
+        const AlphaTestedGeometry& geometry = geometries[i];
+        uint64_t size = 0;
+        size_t alphaSize = 0;
+        if (geometry.isDirty) { // clean geometry is neither baked nor decoded
+            for (uint64_t predictedSize : geometry.predictedSizes)
+                size += predictedSize;
+            if (!batchSources.count(geometry.alphaSourceIndex))
+                alphaSize = alphaSources[geometry.alphaSourceIndex].decodedSize;
+        }
+
+        bool isOverAlphaBudget = alphaBudget && alphaAccumulation + alphaSize > alphaBudget;
+        bool isSameSource = keepSourcesTogether && geometry.isDirty && geometry.alphaSourceIndex == lastSourceIndex; // scene deduplication only merges geometries within one bake call
+        if (batches.empty() || (!isSameSource && (accumulation + size > batchOutputSize || isOverAlphaBudget))) {
+            batches.push_back({i, 0});
+            batchSources.clear();
+            accumulation = 0;
+            alphaAccumulation = 0;
+            if (geometry.isDirty)
+                alphaSize = alphaSources[geometry.alphaSourceIndex].decodedSize;
+        }
+        ++batches.back().count;
+        accumulation += size;
+        alphaAccumulation += alphaSize;
+        if (geometry.isDirty) {
+            batchSources.insert(geometry.alphaSourceIndex);
+            lastSourceIndex = geometry.alphaSourceIndex;
+        }
+    }
+    return batches;
+}
+
 std::vector<OmmBatch> GetGpuBakerBatches(const std::vector<AlphaTestedGeometry>& geometries, const OmmGpuBakerPrebuildMemoryStats& memoryStats, const size_t batchSize) {
     const size_t batchMaxSize = batchSize > geometries.size() ? geometries.size() : batchSize;
     std::vector<OmmBatch> batches(1);
@@ -1702,22 +2364,82 @@ std::vector<OmmBatch> GetGpuBakerBatches(const std::vector<AlphaTestedGeometry>&
     return batches;
 }
 
+inline uint64_t GetOmmBakerBufferSizeClass(uint64_t size) { // quarter steps between powers of two, a class is at most 25% over the request
+    uint64_t powerOfTwo = OMM_GPU_BAKER_BUFFER_POOL_MIN_SIZE;
+    while (powerOfTwo < size)
+        powerOfTwo <<= 1;
+    if (powerOfTwo == OMM_GPU_BAKER_BUFFER_POOL_MIN_SIZE)
+        return powerOfTwo;
+
+    uint64_t base = powerOfTwo >> 1;
+    uint64_t step = base >> 2;
+    return base + (size - base + step - 1) / step * step;
+}
+
+nri::Buffer* Sample::AcquireOmmBakerBuffer(uint64_t size, nri::BufferUsageBits usage, nri::MemoryLocation location) {
+    uint64_t sizeClass = GetOmmBakerBufferSizeClass(size);
+    uint64_t maxSize = uint64_t(double(sizeClass) * OMM_GPU_BAKER_BUFFER_POOL_MAX_SLACK); // bounds the memory wasted by a reuse
+    size_t bestFit = m_OmmGpuBufferPool.size();
+    for (size_t i = m_OmmGpuBufferPool.size(); i > 0; --i) { // smallest idle buffer that fits, most recently used first among equals
+        const OmmPooledBuffer& pooledBuffer = m_OmmGpuBufferPool[i - 1];
+        bool isFit = pooledBuffer.size >= sizeClass && pooledBuffer.size <= maxSize && pooledBuffer.usage == usage && pooledBuffer.location == location;
+        if (isFit && (bestFit == m_OmmGpuBufferPool.size() || pooledBuffer.size < m_OmmGpuBufferPool[bestFit].size))
+            bestFit = i - 1;
+    }
+
+    if (bestFit < m_OmmGpuBufferPool.size()) {
+        m_OmmGpuBufferPoolSize -= m_OmmGpuBufferPool[bestFit].size;
+        m_OmmGpuBuffersInUse.push_back(std::move(m_OmmGpuBufferPool[bestFit]));
+        m_OmmGpuBufferPool.erase(m_OmmGpuBufferPool.begin() + bestFit);
+        return m_OmmGpuBuffersInUse.back().buffer;
+    }
+
+    OmmPooledBuffer& pooledBuffer = m_OmmGpuBuffersInUse.emplace_back();
+    pooledBuffer.size = sizeClass;
+    pooledBuffer.usage = usage;
+    pooledBuffer.location = location;
+
+    nri::BufferDesc bufferDesc = {};
+    bufferDesc.structureStride = sizeof(uint32_t);
+    bufferDesc.size = sizeClass;
+    bufferDesc.usage = usage;
+    NRI_ABORT_ON_FAILURE(NRI.CreateBuffer(*m_Device, bufferDesc, pooledBuffer.buffer));
+    BindBuffersToMemory(NRI, m_Device, &pooledBuffer.buffer, 1, pooledBuffer.memories, location);
+
+    return pooledBuffer.buffer;
+}
+
+void Sample::ReleaseOmmBakerBuffers() { // the bake is complete, its buffers become idle
+    for (OmmPooledBuffer& pooledBuffer : m_OmmGpuBuffersInUse) {
+        m_OmmGpuBufferPoolSize += pooledBuffer.size;
+        m_OmmGpuBufferPool.push_back(std::move(pooledBuffer));
+    }
+    m_OmmGpuBuffersInUse.clear();
+}
+
+void Sample::TrimOmmBakerBufferPool(uint64_t budget) { // least recently used go first
+    size_t evictedNum = 0;
+    for (; evictedNum < m_OmmGpuBufferPool.size() && m_OmmGpuBufferPoolSize > budget; ++evictedNum) {
+        OmmPooledBuffer& pooledBuffer = m_OmmGpuBufferPool[evictedNum];
+        m_OmmHelper.ReleaseGpuBakerViews(pooledBuffer.buffer); // views cached by the gpu baker must go first, the next buffer may get the same address
+        NRI.DestroyBuffer(pooledBuffer.buffer);
+        for (nri::Memory* memory : pooledBuffer.memories)
+            NRI.FreeMemory(memory);
+        m_OmmGpuBufferPoolSize -= pooledBuffer.size;
+    }
+    m_OmmGpuBufferPool.erase(m_OmmGpuBufferPool.begin(), m_OmmGpuBufferPool.begin() + evictedNum);
+}
+
 void Sample::CreateAndBindGpuBakerReadbackBuffer(const OmmGpuBakerPrebuildMemoryStats& memoryStats) { // for caching gpu produced omm_sdk output
     size_t dataTypeBegin = (size_t)ommhelper::OmmDataLayout::ArrayData;
     size_t dataTypeEnd = (size_t)ommhelper::OmmDataLayout::DescArrayHistogram;
     size_t micromapAlignment = NRI.GetDeviceDesc(*m_Device).memoryAlignment.micromapOffset;
     {
         for (size_t i = dataTypeBegin; i < dataTypeEnd; ++i) {
-            nri::BufferDesc bufferDesc = {};
-            bufferDesc.structureStride = sizeof(uint32_t);
             size_t s = memoryStats.outputTotalSizes[i];
             size_t a = micromapAlignment;
-            bufferDesc.size = ((s + a - 1) / a) * a;
-            // bufferDesc.size = memoryStats.outputTotalSizes[i];
-            bufferDesc.usage = nri::BufferUsageBits::NONE;
-            NRI_ABORT_ON_FAILURE(NRI.CreateBuffer(*m_Device, bufferDesc, m_OmmGpuReadbackBuffers[i]));
+            m_OmmGpuReadbackBuffers[i] = AcquireOmmBakerBuffer(((s + a - 1) / a) * a, nri::BufferUsageBits::NONE, nri::MemoryLocation::HOST_READBACK);
         }
-        BindBuffersToMemory(NRI, m_Device, &m_OmmGpuReadbackBuffers[dataTypeBegin], dataTypeEnd - dataTypeBegin, m_OmmBakerAllocations, nri::MemoryLocation::HOST_READBACK);
     }
 
     { // bind baker instances to the buffer
@@ -1742,13 +2464,8 @@ void Sample::CreateAndBindGpuBakerReadbackBuffer(const OmmGpuBakerPrebuildMemory
 void Sample::CreateAndBindGpuBakerArrayDataBuffer(const OmmGpuBakerPrebuildMemoryStats& memoryStats) { // in case of using setup pass of OMM-SDK, array data buffer allocation must be done separately
     const uint32_t arrayDataId = (uint32_t)ommhelper::OmmDataLayout::ArrayData;
     const size_t ommAlignment = NRI.GetDeviceDesc(*m_Device).memoryAlignment.micromapOffset;
-    nri::BufferDesc bufferDesc = {};
-    bufferDesc.structureStride = sizeof(uint32_t);
-    bufferDesc.size = memoryStats.outputTotalSizes[arrayDataId];
-    bufferDesc.size = helper::Align(bufferDesc.size, ommAlignment);
-    bufferDesc.usage = nri::BufferUsageBits::SHADER_RESOURCE_STORAGE | nri::BufferUsageBits::SHADER_RESOURCE;
-    NRI_ABORT_ON_FAILURE(NRI.CreateBuffer(*m_Device, bufferDesc, m_OmmGpuOutputBuffers[arrayDataId]));
-    BindBuffersToMemory(NRI, m_Device, &m_OmmGpuOutputBuffers[arrayDataId], 1, m_OmmBakerAllocations, nri::MemoryLocation::DEVICE);
+    uint64_t size = helper::Align(memoryStats.outputTotalSizes[arrayDataId], ommAlignment);
+    m_OmmGpuOutputBuffers[arrayDataId] = AcquireOmmBakerBuffer(size, nri::BufferUsageBits::SHADER_RESOURCE_STORAGE | nri::BufferUsageBits::SHADER_RESOURCE, nri::MemoryLocation::DEVICE);
 
     size_t offset = 0;
     for (size_t id = 0; id < m_OmmAlphaGeometry.size(); ++id) {
@@ -1764,43 +2481,34 @@ void Sample::CreateAndBindGpuBakerArrayDataBuffer(const OmmGpuBakerPrebuildMemor
     }
 }
 
-void Sample::CreateAndBindGpuBakerSatitcBuffers(const OmmGpuBakerPrebuildMemoryStats& memoryStats) {
+void Sample::CreateAndBindGpuBakerSatitcBuffers(const OmmGpuBakerPrebuildMemoryStats& memoryStats, uint32_t maxGeometriesPerBake) {
     const size_t postBakeReadbackDataBegin = (size_t)ommhelper::OmmDataLayout::DescArrayHistogram;
     const size_t staticDataBegin = (size_t)ommhelper::OmmDataLayout::DescArray;
     const size_t buffersEnd = (size_t)ommhelper::OmmDataLayout::GpuOutputNum;
 
-    nri::BufferDesc bufferDesc = {};
-    bufferDesc.structureStride = sizeof(uint32_t);
-
-    std::vector<nri::Buffer*> gpuBuffers;
-    std::vector<nri::Buffer*> readbackBuffers;
-    for (size_t i = staticDataBegin; i < buffersEnd; ++i) {
-        bufferDesc.size = memoryStats.outputTotalSizes[i];
-        bufferDesc.usage = nri::BufferUsageBits::SHADER_RESOURCE_STORAGE | nri::BufferUsageBits::SHADER_RESOURCE;
-        NRI_ABORT_ON_FAILURE(NRI.CreateBuffer(*m_Device, bufferDesc, m_OmmGpuOutputBuffers[i]));
-        gpuBuffers.push_back(m_OmmGpuOutputBuffers[i]);
-    }
+    for (size_t i = staticDataBegin; i < buffersEnd; ++i)
+        m_OmmGpuOutputBuffers[i] = AcquireOmmBakerBuffer(memoryStats.outputTotalSizes[i], nri::BufferUsageBits::SHADER_RESOURCE_STORAGE | nri::BufferUsageBits::SHADER_RESOURCE, nri::MemoryLocation::DEVICE);
 
+    // geometries use the transient slices round robin. The baker interleaves the dispatches of geometries writing different slices,
+    // which needs more than one geometry per bake: the async path bakes them one by one and gets a single slice
+    uint32_t transientAlignment = NRI.GetDeviceDesc(*m_Device).memoryAlignment.bufferShaderResourceOffset;
+    uint64_t transientSliceSizes[OMM_MAX_TRANSIENT_POOL_BUFFERS] = {};
+    uint64_t transientSlicesSize = 0;
     for (size_t i = 0; i < OMM_MAX_TRANSIENT_POOL_BUFFERS; ++i) {
-        bufferDesc.size = memoryStats.maxTransientBufferSizes[i];
-        if (bufferDesc.size) {
-            bufferDesc.usage = nri::BufferUsageBits::SHADER_RESOURCE_STORAGE | nri::BufferUsageBits::SHADER_RESOURCE | nri::BufferUsageBits::ARGUMENT_BUFFER;
-            NRI_ABORT_ON_FAILURE(NRI.CreateBuffer(*m_Device, bufferDesc, m_OmmGpuTransientBuffers[i]));
-            gpuBuffers.push_back(m_OmmGpuTransientBuffers[i]);
-        }
+        transientSliceSizes[i] = helper::Align(memoryStats.maxTransientBufferSizes[i], transientAlignment);
+        transientSlicesSize += transientSliceSizes[i];
     }
+    uint32_t maxSliceNum = std::clamp(maxGeometriesPerBake, 1u, OMM_GPU_BAKER_MAX_TRANSIENT_SLICES);
+    uint32_t transientSliceNum = (uint32_t)std::clamp<uint64_t>(OMM_GPU_BAKER_TRANSIENT_BUDGET / std::max<uint64_t>(transientSlicesSize, 1), 1, maxSliceNum);
 
-    for (size_t i = postBakeReadbackDataBegin; i < buffersEnd; ++i) {
-        bufferDesc.size = memoryStats.outputTotalSizes[i];
-        bufferDesc.usage = nri::BufferUsageBits::NONE;
-        NRI_ABORT_ON_FAILURE(NRI.CreateBuffer(*m_Device, bufferDesc, m_OmmGpuReadbackBuffers[i]));
-        readbackBuffers.push_back(m_OmmGpuReadbackBuffers[i]);
+    for (size_t i = 0; i < OMM_MAX_TRANSIENT_POOL_BUFFERS; ++i) {
+        uint64_t size = transientSliceSizes[i] * transientSliceNum;
+        if (size)
+            m_OmmGpuTransientBuffers[i] = AcquireOmmBakerBuffer(size, nri::BufferUsageBits::SHADER_RESOURCE_STORAGE | nri::BufferUsageBits::SHADER_RESOURCE | nri::BufferUsageBits::ARGUMENT_BUFFER, nri::MemoryLocation::DEVICE);
     }
 
-    { // Bind memories
-        BindBuffersToMemory(NRI, m_Device, gpuBuffers.data(), gpuBuffers.size(), m_OmmBakerAllocations, nri::MemoryLocation::DEVICE);
-        BindBuffersToMemory(NRI, m_Device, readbackBuffers.data(), readbackBuffers.size(), m_OmmBakerAllocations, nri::MemoryLocation::HOST_READBACK);
-    }
+    for (size_t i = postBakeReadbackDataBegin; i < buffersEnd; ++i)
+        m_OmmGpuReadbackBuffers[i] = AcquireOmmBakerBuffer(memoryStats.outputTotalSizes[i], nri::BufferUsageBits::NONE, nri::MemoryLocation::HOST_READBACK);
 
     size_t gpuOffsetsPerType[(uint32_t)ommhelper::OmmDataLayout::GpuOutputNum] = {};
     size_t readBackOffsetsPerType[(uint32_t)ommhelper::OmmDataLayout::GpuOutputNum] = {};
@@ -1831,9 +2539,9 @@ void Sample::CreateAndBindGpuBakerSatitcBuffers(const OmmGpuBakerPrebuildMemoryS
 
         for (size_t j = 0; j < OMM_MAX_TRANSIENT_POOL_BUFFERS; ++j) {
             desc.transientBuffers[j].buffer = m_OmmGpuTransientBuffers[j];
-            desc.transientBuffers[j].bufferSize = memoryStats.maxTransientBufferSizes[j];
+            desc.transientBuffers[j].bufferSize = transientSliceSizes[j] * transientSliceNum;
             desc.transientBuffers[j].dataSize = memoryStats.maxTransientBufferSizes[j];
-            desc.transientBuffers[j].offset = 0;
+            desc.transientBuffers[j].offset = transientSliceSizes[j] * (id % transientSliceNum);
         }
     }
 }
@@ -1846,7 +2554,7 @@ void Sample::SaveMaskCache(const OmmBatch& batch) {
     for (size_t id = batch.offset; id < batch.offset + batch.count; ++id) {
         AlphaTestedGeometry& geometry = m_OmmAlphaGeometry[id];
         ommhelper::OmmBakeGeometryDesc& bakeResults = geometry.bakeDesc;
-        uint64_t hash = GetInstanceHash(geometry.meshIndex, geometry.materialIndex);
+        uint64_t hash = GetOmmCacheHash(geometry);
 
         bool isDataValid = true;
         ommhelper::OmmCaching::OmmData data;
@@ -1862,8 +2570,10 @@ void Sample::SaveMaskCache(const OmmBatch& batch) {
 
 void Sample::InitializeOmmGeometryFromCache(const OmmBatch& batch, std::vector<ommhelper::OmmBakeGeometryDesc*>& outBakeQueue) { // Init geometry from cache. If cache not found add it to baking queue
     if (m_OmmBakeDesc.enableCache == false) {
-        for (size_t i = batch.offset; i < batch.offset + batch.count; ++i)
-            outBakeQueue.push_back(&m_OmmAlphaGeometry[i].bakeDesc);
+        for (size_t i = batch.offset; i < batch.offset + batch.count; ++i) {
+            if (m_OmmAlphaGeometry[i].isDirty)
+                outBakeQueue.push_back(&m_OmmAlphaGeometry[i].bakeDesc);
+        }
         return;
     }
 
@@ -1872,8 +2582,10 @@ void Sample::InitializeOmmGeometryFromCache(const OmmBatch& batch, std::vector<o
     for (size_t i = batch.offset; i < batch.offset + batch.count; ++i) {
         AlphaTestedGeometry& geometry = m_OmmAlphaGeometry[i];
         ommhelper::OmmBakeGeometryDesc& instance = geometry.bakeDesc;
+        if (!geometry.isDirty)
+            continue;
 
-        uint64_t hash = GetInstanceHash(geometry.meshIndex, geometry.materialIndex);
+        uint64_t hash = GetOmmCacheHash(geometry);
         ommhelper::OmmCaching::OmmData data = {};
         if (ommhelper::OmmCaching::ReadMaskFromCache(GetOmmCacheFilename().c_str(), data, stateMask, hash, nullptr)) {
             for (uint32_t j = 0; j < (uint32_t)ommhelper::OmmDataLayout::CpuMaxNum; ++j) {
@@ -1930,6 +2642,13 @@ void Sample::BakeOmmGpu(OmmNriContext& context, std::vector<ommhelper::OmmBakeGe
     NRI.BeginCommandBuffer(*context.commandBuffer, nullptr);
     {
         m_OmmHelper.BakeOpacityMicroMapsGpu(context.commandBuffer, batch.data(), batch.size(), m_OmmBakeDesc, ommhelper::OmmGpuBakerPass::Bake);
+        const BakerBindStats& bindStats = m_OmmHelper.GetGpuBakerBindStats();
+        m_OmmBakeBindStats.pipelineNum += bindStats.pipelineNum;
+        m_OmmBakeBindStats.pipelineSkippedNum += bindStats.pipelineSkippedNum;
+        m_OmmBakeBindStats.pipelineLayoutNum += bindStats.pipelineLayoutNum;
+        m_OmmBakeBindStats.pipelineLayoutSkippedNum += bindStats.pipelineLayoutSkippedNum;
+        m_OmmBakeBindStats.descriptorSetNum += bindStats.descriptorSetNum;
+        m_OmmBakeBindStats.descriptorSetSkippedNum += bindStats.descriptorSetSkippedNum;
         CopyBatchToReadBackBuffer(NRI, context.commandBuffer, *batch[0], *batch.back(), (uint32_t)ommhelper::OmmDataLayout::DescArrayHistogram);
         CopyBatchToReadBackBuffer(NRI, context.commandBuffer, *batch[0], *batch.back(), (uint32_t)ommhelper::OmmDataLayout::IndexHistogram);
         CopyBatchToReadBackBuffer(NRI, context.commandBuffer, *batch[0], *batch.back(), (uint32_t)ommhelper::OmmDataLayout::GpuPostBuildInfo);
@@ -1977,11 +2696,16 @@ void Sample::BakeOmmGpu(OmmNriContext& context, std::vector<ommhelper::OmmBakeGe
     }
 }
 
-void Sample::OmmGeometryUpdate(OmmNriContext& context, bool doBatching) {
-    ReleaseMaskedGeometry();
+void Sample::OmmGeometryUpdate(OmmNriContext& context, bool doBatching, bool hotSwap) { // hotSwap: keep the published masked geometry alive and replace it per geometry as the new one is built
+    if (!hotSwap)
+        ReleaseMaskedGeometry();
+    m_OmmBakeBindStats = {};
     FillOmmBakerInputs();
+    PredictOmmOutputSizes(true);
     OmmGpuBakerPrebuildMemoryStats memoryStats = {};
     std::vector<OmmBatch> batches = GetGpuBakerBatches(m_OmmAlphaGeometry, memoryStats, 1);
+    if (m_OmmBakeDesc.type == ommhelper::OmmBakerType::CPU) // both sync and async: a batch is published as a whole, so its size bounds the latency of each hot swap
+        batches = GetCpuBakerBatches(m_OmmAlphaGeometry, m_OmmAlphaSources, OMM_CPU_BAKER_BATCH_OUTPUT_SIZE, m_OmmAlphaStreamingBudget, m_OmmBakeDesc.cpuFlags.enableSceneDeduplication);
 
     if (m_OmmBakeDesc.type == ommhelper::OmmBakerType::GPU) {
         std::vector<ommhelper::OmmBakeGeometryDesc*> queue;
@@ -1989,17 +2713,17 @@ void Sample::OmmGeometryUpdate(OmmNriContext& context, bool doBatching) {
 
         for (size_t instanceId = 0; instanceId < m_OmmAlphaGeometry.size(); ++instanceId) { // skip prepass for instances with cache
             AlphaTestedGeometry& geometry = m_OmmAlphaGeometry[instanceId];
-            uint64_t hash = GetInstanceHash(geometry.meshIndex, geometry.materialIndex);
-            if (ommhelper::OmmCaching::LookForCache(GetOmmCacheFilename().c_str(), stateMask, hash) && m_OmmBakeDesc.enableCache)
+            if (!geometry.isDirty || (m_OmmBakeDesc.enableCache && ommhelper::OmmCaching::LookForCache(GetOmmCacheFilename().c_str(), stateMask, GetOmmCacheHash(geometry)))) // content hashes are only computed with cache on
                 continue;
             queue.push_back(&geometry.bakeDesc);
         }
 
         if (queue.empty() == false) { // perform setup pass
             m_OmmHelper.GetGpuBakerPrebuildInfo(queue.data(), queue.size(), m_OmmBakeDesc);
+            m_OmmHelper.WarmUpGpuBaker(queue.data(), queue.size(), m_OmmBakeDesc); // compile the pipelines now rather than while recording the setup pass
             memoryStats = GetGpuBakerPrebuildMemoryStats(false); // arrayData size calculation is conservative here
 
-            CreateAndBindGpuBakerSatitcBuffers(memoryStats); // create buffers which sizes are correctly calculated in GetGpuBakerPrebuildInfo()
+            CreateAndBindGpuBakerSatitcBuffers(memoryStats, doBatching ? (uint32_t)queue.size() : 1); // create buffers which sizes are correctly calculated in GetGpuBakerPrebuildInfo()
             {                                                // get actual arrayData buffer sizes. GetGpuBakerPrebuildInfo() returns conservative arrayData size estimation
                 RunOmmSetupPass(context, queue.data(), queue.size(), memoryStats);
             }
@@ -2017,6 +2741,10 @@ void Sample::OmmGeometryUpdate(OmmNriContext& context, bool doBatching) {
 
     for (size_t batchId = 0; batchId < batches.size(); ++batchId) {
         const OmmBatch& batch = batches[batchId];
+        if (IsOmmBakeCancelled()) {
+            printf("\n[OMM] Bake cancelled: [%llu / %llu] batches done", batchId, batches.size());
+            break;
+        }
         printf("\r%s\r[OMM] Batch [%llu / %llu]: ", std::string(100, ' ').c_str(), batchId + 1, batches.size());
         std::vector<ommhelper::OmmBakeGeometryDesc*> bakeQueue;
         InitializeOmmGeometryFromCache(batch, bakeQueue);
@@ -2025,15 +2753,37 @@ void Sample::OmmGeometryUpdate(OmmNriContext& context, bool doBatching) {
             printf("Bake. ");
             if (m_OmmBakeDesc.type == ommhelper::OmmBakerType::GPU)
                 BakeOmmGpu(context, bakeQueue);
-            else
-                m_OmmHelper.BakeOpacityMicroMapsCpu(bakeQueue.data(), bakeQueue.size(), m_OmmBakeDesc);
+            else {
+                if (m_OmmAlphaStreamingBudget)
+                    StreamAlphaSources(batch); // waits for the decode of the batch
+                else {
+                    for (size_t id = batch.offset; id < batch.offset + batch.count; ++id) {
+                        if (m_OmmAlphaGeometry[id].isDirty)
+                            WaitForAlphaDecode(m_OmmAlphaGeometry[id].alphaSourceIndex);
+                    }
+                }
+
+                if (!IsOmmBakeCancelled()) // alpha may be partially decoded past this point
+                    m_OmmHelper.BakeOpacityMicroMapsCpu(bakeQueue.data(), bakeQueue.size(), m_OmmBakeDesc, &m_OmmBakeCancel);
+
+                if (IsOmmBakeCancelled()) // abandoned jobs may still be decoding into sources about to be released
+                    JoinAlphaDecodeWorkers();
+                if (m_OmmAlphaStreamingBudget)
+                    ReleaseUnusedAlphaSources(batch);
+            }
 
             if (m_OmmBakeDesc.enableCache) {
                 printf("Save cache. ");
-                SaveMaskCache(batch);
+                SaveMaskCache(batch); // geometries finished before a cancel are kept, empty outputs are not saved
             }
         }
 
+        if (IsOmmBakeCancelled()) { // the batch may be incomplete, it's not built
+            printf("\n[OMM] Bake cancelled: [%llu / %llu] batches done", batchId, batches.size());
+            break;
+        }
+        CalibrateOmmOutputPrediction(batch);
+
         if (m_DisableOmmBlasBuild == false) {
             printf("Build. ");
 
@@ -2055,9 +2805,9 @@ void Sample::OmmGeometryUpdate(OmmNriContext& context, bool doBatching) {
                     continue;
 
                 uint64_t mask = GetInstanceHash(m_OmmAlphaGeometry[id].meshIndex, m_OmmAlphaGeometry[id].materialIndex);
-                OmmBlas ommBlas = {buildDesc.outputs.blas, buildDesc.outputs.ommArray};
-                m_InstanceMaskToMaskedBlasData.insert(std::make_pair(mask, ommBlas));
-                m_MaskedBlasses.push_back({buildDesc.outputs.blas, buildDesc.outputs.ommArray});
+                OmmBlas ommBlas = {buildDesc.outputs.blas, buildDesc.outputs.ommArray, buildDesc.prebuildInfo.ommArraySize + buildDesc.prebuildInfo.blasSize};
+                PublishMaskedBlas(mask, ommBlas);
+                geometry.builtInputHash = geometry.inputHash;
             }
         }
 
@@ -2076,56 +2826,162 @@ void Sample::OmmGeometryUpdate(OmmNriContext& context, bool doBatching) {
     }
     printf("\n");
 
+    const BakerBindStats& bindStats = m_OmmBakeBindStats;
+    uint32_t skippedBindNum = bindStats.pipelineSkippedNum + bindStats.pipelineLayoutSkippedNum + bindStats.descriptorSetSkippedNum;
+    uint32_t bindNum = bindStats.pipelineNum + bindStats.pipelineLayoutNum + bindStats.descriptorSetNum + skippedBindNum;
+    if (bindNum)
+        printf("[OMM][GPU] Binds skipped as redundant: [%u / %u]\n", skippedBindNum, bindNum);
+
     ReleaseBakingResources();
     m_OmmUpdateProgress = 0;
 }
 
 void Sample::RebuildOmmGeometryAsync(uint32_t const* frameId) {
-    uint32_t fistFrame = *frameId;
-    uint32_t endFrame = fistFrame + GetOptimalSwapChainTextureNum();
-    m_InstanceMaskToMaskedBlasData.clear(); // stop using masked geometry here
+    ResolveOmmGeometryBakeParams();
+    uint32_t dirtyNum = UpdateOmmGeometryDirtyState();
+    m_OmmBakeDirtyNum = dirtyNum;
+    if (m_EnableIncrementalBake && dirtyNum == 0) {
+        m_OmmBakeStage = "Up to date";
+        return;
+    }
 
-    while (*frameId < endFrame)
+    bool isIncremental = m_EnableIncrementalBake && dirtyNum < m_OmmAlphaGeometry.size() && !IsRetiredMaskedGeometryOverLimit(); // clean geometry stays live, dirty one is hot swapped
+    m_OmmBakeStage = isIncremental ? "Incremental" : "Full";
+    if (!isIncremental)
+        StopUsingMaskedGeometry(frameId);
+
+    bool isProgressive = m_EnableProgressiveBake && m_OmmBakeDesc.subdivisionLevel > OMM_PROGRESSIVE_COARSE_SUBDIVISION_LEVEL;
+    if (!isProgressive) {
+        OmmGeometryUpdate(m_OmmComputeContext, false, isIncremental);
+        if (!isIncremental)
+            return;
+    } else {
+        // Coarse pass: publish low subdivision masks for every geometry as fast as possible
+        const ommhelper::OmmBakeDesc targetBakeDesc = m_OmmBakeDesc;
+        if (isIncremental) { // geometry already built at the target stays untouched
+            m_OmmUpdateFilter.resize(m_OmmAlphaGeometry.size());
+            for (size_t id = 0; id < m_OmmAlphaGeometry.size(); ++id)
+                m_OmmUpdateFilter[id] = m_OmmAlphaGeometry[id].isDirty;
+        }
+        m_OmmBakeDesc.subdivisionLevel = OMM_PROGRESSIVE_COARSE_SUBDIVISION_LEVEL;
+        m_OmmBakeStage = "Coarse pass";
+        OmmGeometryUpdate(m_OmmComputeContext, false, isIncremental);
+        m_OmmUpdateFilter.clear();
+
+        // Refinement pass: swap each geometry to the target level as soon as its batch is built
+        m_OmmBakeDesc = targetBakeDesc;
+        if (!IsOmmBakeCancelled()) {
+            m_OmmBakeStage = "Refinement pass";
+            OmmGeometryUpdate(m_OmmComputeContext, false, true);
+        }
+    }
+
+    uint32_t retireFrame = *frameId + GetOptimalSwapChainTextureNum();
+    while (*frameId < retireFrame)
         Sleep(1);
 
-    OmmGeometryUpdate(m_OmmComputeContext, false);
+    ReleaseRetiredMaskedGeometry();
+
+    if (m_OmmBakeDesc.enableCache && !IsOmmBakeCancelled() && IsRetiredMaskedGeometryOverLimit()) { // everything is cached now, so a full rebuild is cheap. Without cache the next bake does it
+        printf("[OMM] Retired masked geometry exceeds [%llu] mb, rebuilding from cache\n", OMM_RETIRED_GEOMETRY_MEMORY_LIMIT >> 20);
+        StopUsingMaskedGeometry(frameId);
+        OmmGeometryUpdate(m_OmmComputeContext, false);
+    }
+}
+
+void Sample::StopUsingMaskedGeometry(uint32_t const* frameId) { // frames fall back to the original blas until the masked geometry is published again
+    uint32_t endFrame = *frameId + GetOptimalSwapChainTextureNum();
+    {
+        std::lock_guard<std::mutex> lock(m_MaskedBlasMutex);
+        m_InstanceMaskToMaskedBlasData.clear();
+    }
+
+    while (*frameId < endFrame)
+        Sleep(1);
 }
 
 void Sample::RebuildOmmGeometry() {
     NRI.QueueWaitIdle(m_GraphicsQueue);
-    OmmGeometryUpdate(m_OmmGraphicsContext, true);
+    ResolveOmmGeometryBakeParams();
+    uint32_t dirtyNum = UpdateOmmGeometryDirtyState();
+    m_OmmBakeDirtyNum = dirtyNum;
+    if (m_EnableIncrementalBake && dirtyNum == 0) {
+        m_OmmBakeStage = "Up to date";
+        return;
+    }
+
+    bool isIncremental = m_EnableIncrementalBake && dirtyNum < m_OmmAlphaGeometry.size() && !IsRetiredMaskedGeometryOverLimit();
+    m_OmmBakeStage = isIncremental ? "Incremental" : "Full";
+    OmmGeometryUpdate(m_OmmGraphicsContext, true, isIncremental);
+    if (isIncremental) // the queue is idle, nothing references the replaced geometry anymore
+        ReleaseRetiredMaskedGeometry();
+
+    if (m_OmmBakeDesc.enableCache && IsRetiredMaskedGeometryOverLimit()) {
+        printf("[OMM] Retired masked geometry exceeds [%llu] mb, rebuilding from cache\n", OMM_RETIRED_GEOMETRY_MEMORY_LIMIT >> 20);
+        OmmGeometryUpdate(m_OmmGraphicsContext, true);
+    }
+}
+
+void Sample::PublishMaskedBlas(uint64_t instanceMask, const OmmBlas& ommBlas) {
+    std::lock_guard<std::mutex> lock(m_MaskedBlasMutex);
+    const auto& it = m_InstanceMaskToMaskedBlasData.find(instanceMask);
+    if (it != m_InstanceMaskToMaskedBlasData.end()) { // hot swap: previous version can still be referenced by frames in flight
+        m_RetiredMaskedBlasses.push_back(it->second);
+        it->second = ommBlas;
+    } else
+        m_InstanceMaskToMaskedBlasData.insert(std::make_pair(instanceMask, ommBlas));
+    m_MaskedBlasses.push_back(ommBlas);
 }
 
 void Sample::ReleaseMaskedGeometry() {
+    std::lock_guard<std::mutex> lock(m_MaskedBlasMutex);
     for (auto& resource : m_MaskedBlasses)
         m_OmmHelper.DestroyMaskedGeometry(resource.blas, resource.ommArray);
 
     m_InstanceMaskToMaskedBlasData.clear();
     m_MaskedBlasses.clear();
+    m_RetiredMaskedBlasses.clear(); // retired geometry is still owned by m_MaskedBlasses
+    m_RetiredMaskedGeometrySize = 0;
     m_OmmHelper.ReleaseGeometryMemory();
+
+    for (AlphaTestedGeometry& geometry : m_OmmAlphaGeometry)
+        geometry.builtInputHash = 0;
+}
+
+void Sample::ReleaseRetiredMaskedGeometry() { // memory of retired geometry stays in the helper heaps until the next ReleaseMaskedGeometry()
+    std::lock_guard<std::mutex> lock(m_MaskedBlasMutex);
+    for (const OmmBlas& retired : m_RetiredMaskedBlasses) {
+        m_OmmHelper.DestroyMaskedGeometry(retired.blas, retired.ommArray);
+        m_RetiredMaskedGeometrySize += retired.size;
+        auto isRetired = [&retired](const OmmBlas& ommBlas) { return ommBlas.blas == retired.blas; };
+        m_MaskedBlasses.erase(std::remove_if(m_MaskedBlasses.begin(), m_MaskedBlasses.end(), isRetired), m_MaskedBlasses.end());
+    }
+    m_RetiredMaskedBlasses.clear();
+}
+
+bool Sample::IsRetiredMaskedGeometryOverLimit() {
+    std::lock_guard<std::mutex> lock(m_MaskedBlasMutex);
+    return m_RetiredMaskedGeometrySize > OMM_RETIRED_GEOMETRY_MEMORY_LIMIT;
 }
 
 void Sample::ReleaseBakingResources() {
     for (AlphaTestedGeometry& geometry : m_OmmAlphaGeometry) {
         geometry.bakeDesc = {};
         geometry.buildDesc = {};
+        geometry.croppedUvData.resize(0);
+        geometry.croppedUvData.shrink_to_fit();
     }
 
-    m_OmmRawAlphaChannelForCpuBaker.resize(0);
-    m_OmmRawAlphaChannelForCpuBaker.shrink_to_fit();
+    ReleaseAlphaSources();
+    m_OmmHelper.CpuPostBakeCleanUp();
+    ommhelper::AlphaMipCache::UnmapAll();
 
-    // Destroy buffers
-    auto DestroyBuffers = [](NRIInterface& nri, nri::Buffer** buffers, uint32_t count) {
-        for (uint32_t i = 0; i < count; ++i) {
-            if (buffers[i]) {
-                nri.DestroyBuffer(buffers[i]);
-                buffers[i] = nullptr;
-            }
-        }
-    };
-    DestroyBuffers(NRI, m_OmmGpuOutputBuffers, (uint32_t)ommhelper::OmmDataLayout::GpuOutputNum);
-    DestroyBuffers(NRI, m_OmmGpuReadbackBuffers, (uint32_t)ommhelper::OmmDataLayout::GpuOutputNum);
-    DestroyBuffers(NRI, m_OmmGpuTransientBuffers, OMM_MAX_TRANSIENT_POOL_BUFFERS);
+    // Gpu baker buffers go back to the pool, the next bake reuses the ones its sizes fit in
+    std::fill(std::begin(m_OmmGpuOutputBuffers), std::end(m_OmmGpuOutputBuffers), nullptr);
+    std::fill(std::begin(m_OmmGpuReadbackBuffers), std::end(m_OmmGpuReadbackBuffers), nullptr);
+    std::fill(std::begin(m_OmmGpuTransientBuffers), std::end(m_OmmGpuTransientBuffers), nullptr);
+    ReleaseOmmBakerBuffers();
+    TrimOmmBakerBufferPool(uint64_t(m_OmmGpuBufferPoolBudgetMb) << 20);
 
     for (auto& buffer : m_OmmCpuUploadBuffers)
         NRI.DestroyBuffer(buffer);
@@ -2138,11 +2994,6 @@ void Sample::ReleaseBakingResources() {
     m_OmmTmpAllocations.resize(0);
     m_OmmTmpAllocations.shrink_to_fit();
 
-    for (auto& memory : m_OmmBakerAllocations)
-        NRI.FreeMemory(memory);
-    m_OmmBakerAllocations.resize(0);
-    m_OmmBakerAllocations.shrink_to_fit();
-
     m_OmmHelper.GpuPostBakeCleanUp();
 }
 
@@ -2161,6 +3012,8 @@ bool IsRebuildAvailable(ommhelper::OmmBakeDesc& updated, ommhelper::OmmBakeDesc&
     result |= updated.subdivisionLevel != current.subdivisionLevel;
     result |= updated.mipBias != current.mipBias;
     result |= updated.dynamicSubdivisionScale != current.dynamicSubdivisionScale;
+    result |= updated.enableAutoSubdivisionLevel != current.enableAutoSubdivisionLevel;
+    result |= updated.memoryBudgetMb != current.memoryBudgetMb;
     result |= updated.filter != current.filter;
     result |= updated.format != current.format;
 
@@ -2180,6 +3033,7 @@ bool IsRebuildAvailable(ommhelper::OmmBakeDesc& updated, ommhelper::OmmBakeDesc&
         result |= updated.cpuFlags.enableNearDuplicateDetection != current.cpuFlags.enableNearDuplicateDetection;
         result |= updated.cpuFlags.force32bitIndices != current.cpuFlags.force32bitIndices;
         result |= updated.cpuFlags.allow8bitIndices != current.cpuFlags.allow8bitIndices;
+        result |= updated.cpuFlags.enableSceneDeduplication != current.cpuFlags.enableSceneDeduplication;
     }
 
     result |= ((current.enableCache == false) && updated.enableCache);
@@ -2248,6 +3102,9 @@ void Sample::AppendOmmImguiSettings() {
                 ImGui::Checkbox("DuplicateDetection", &cpuFlags.enableDuplicateDetection);
                 ImGui::SameLine();
                 ImGui::Checkbox("NearDuplicateDetection", &cpuFlags.enableNearDuplicateDetection);
+                ImGui::Checkbox("SceneDeduplication", &cpuFlags.enableSceneDeduplication);
+                if (ImGui::IsItemHovered())
+                    ImGui::SetTooltip("Bake identical uv triangles of all geometries sharing a texture only once");
             } else // if GPU
             {
                 ommhelper::GpuBakerFlags& gpuFlags = bakeDesc.gpuFlags;
@@ -2303,6 +3160,10 @@ void Sample::AppendOmmImguiSettings() {
             sprintf(buffer, "Max Subdivision Level [1 : %d] ", maxSubdivisionLevel);
             ImGui::InputInt(buffer, &subdivisionLevel);
             ImGui::PopItemWidth();
+            ImGui::SameLine();
+            ImGui::Checkbox("Auto", &bakeDesc.enableAutoSubdivisionLevel);
+            if (ImGui::IsItemHovered())
+                ImGui::SetTooltip("Per geometry level from texel density: micro-triangles are never finer than about one texel");
             subdivisionLevel = subdivisionLevel < 1 ? 1 : subdivisionLevel;
             subdivisionLevel = subdivisionLevel > maxSubdivisionLevel ? maxSubdivisionLevel : subdivisionLevel;
 
@@ -2311,6 +3172,18 @@ void Sample::AppendOmmImguiSettings() {
             ImGui::PopItemWidth();
             mipBias = mipBias < 0 ? 0 : mipBias;
             mipBias = mipBias > 15 ? 15 : mipBias;
+
+            static int memoryBudgetMb = bakeDesc.memoryBudgetMb;
+            ImGui::PushItemWidth(ImGui::CalcItemWidth() * 0.33f);
+            ImGui::InputInt("Memory Budget MB (0 - unlimited)", &memoryBudgetMb);
+            ImGui::PopItemWidth();
+            if (ImGui::IsItemHovered())
+                ImGui::SetTooltip("Lower per geometry subdivision levels and formats until the predicted output fits");
+            memoryBudgetMb = memoryBudgetMb < 0 ? 0 : memoryBudgetMb;
+            if (m_OmmBakeDesc.memoryBudgetMb) {
+                double achievedMb = double(m_OmmBudgetPredictedSize.load(std::memory_order_relaxed)) / 1024.0 / 1024.0;
+                ImGui::Text("Budget: %.2f / %u MB predicted%s", achievedMb, m_OmmBakeDesc.memoryBudgetMb, achievedMb > double(m_OmmBakeDesc.memoryBudgetMb) ? " (exceeded)" : "");
+            }
             static bool enableCaching = bakeDesc.enableCache;
 
             if (isCpuBaker) {
@@ -2320,6 +3193,20 @@ void Sample::AppendOmmImguiSettings() {
                 int maxMipRange = OMM_MAX_MIP_NUM - mipBias;
                 mipCount = mipCount < 1 ? 1 : mipCount;
                 mipCount = mipCount > maxMipRange ? maxMipRange : mipCount;
+
+                static int alphaDecodeBudgetMb = bakeDesc.alphaDecodeBudgetMb;
+                ImGui::PushItemWidth(ImGui::CalcItemWidth() * 0.33f);
+                ImGui::InputInt("Alpha Decode Budget MB (0 - unlimited)", &alphaDecodeBudgetMb);
+                ImGui::PopItemWidth();
+                alphaDecodeBudgetMb = alphaDecodeBudgetMb < 0 ? 0 : alphaDecodeBudgetMb;
+                bakeDesc.alphaDecodeBudgetMb = alphaDecodeBudgetMb; // applied from the next bake, the running one keeps its snapshot
+            } else {
+                ImGui::PushItemWidth(ImGui::CalcItemWidth() * 0.33f);
+                ImGui::InputInt("Buffer Pool Budget MB", &m_OmmGpuBufferPoolBudgetMb);
+                ImGui::PopItemWidth();
+                if (ImGui::IsItemHovered())
+                    ImGui::SetTooltip("Idle baker buffers kept for the next gpu bake");
+                m_OmmGpuBufferPoolBudgetMb = m_OmmGpuBufferPoolBudgetMb < 0 ? 0 : m_OmmGpuBufferPoolBudgetMb;
             }
 
             bakeDesc.format = ommhelper::OmmFormats(ommFormatSelection);
@@ -2329,6 +3216,7 @@ void Sample::AppendOmmImguiSettings() {
             bakeDesc.mipCount = mipCount;
             bakeDesc.type = ommhelper::OmmBakerType(ommBakerTypeSelection);
             bakeDesc.enableCache = enableCaching;
+            bakeDesc.memoryBudgetMb = memoryBudgetMb;
 
             bool isRebuildAvailable = IsRebuildAvailable(bakeDesc, m_OmmBakeDesc);
 
@@ -2342,28 +3230,60 @@ void Sample::AppendOmmImguiSettings() {
             const static ImU32 redColor = ImGui::GetColorU32(ImVec4(0.6f, 0.0f, 0.0f, 1.0f));
 
             static uint32_t frameId = 0;
+            static bool isRestartPending = false; // settings changed mid-flight, bake again once the running one is cancelled
             bool forceRebuild = frameId == m_OmmBakeDesc.buildFrameId;
             {
                 ImU32 buttonColor = isRebuildAvailable ? greenColor : greyColor;
                 buttonColor = isAsyncActive ? redColor : buttonColor;
 
+                bool launchAsyncTask = (m_EnableAsync && !isCpuBaker) || isCpuBaker;
                 ImGui::PushStyleColor(ImGuiCol_::ImGuiCol_Button, buttonColor);
-                if ((ImGui::Button("Bake OMMs") || forceRebuild) && !isAsyncActive) {
+                bool isBakeRequested = ImGui::Button("Bake OMMs") || forceRebuild || isRestartPending;
+                if (isBakeRequested && isAsyncActive) {
+                    m_OmmBakeCancel = true;
+                    isRestartPending = true;
+                } else if (isBakeRequested) {
+                    m_OmmBakeCancel = false;
+                    isRestartPending = false;
                     m_OmmBakeDesc = bakeDesc;
 
-                    bool launchAsyncTask = (m_EnableAsync && !isCpuBaker) || isCpuBaker;
                     if (launchAsyncTask)
                         asyncUpdateTask = std::async(std::launch::async, &Sample::RebuildOmmGeometryAsync, this, &frameId);
                     else
                         RebuildOmmGeometry();
                 }
                 ImGui::PopStyleColor();
+                if (ImGui::IsItemHovered() && isAsyncActive)
+                    ImGui::SetTooltip("Cancel the running bake and start a new one with the current settings");
 
                 ImGui::SameLine();
                 ImGui::Checkbox("Use OMM Cache", &enableCaching);
+                ImGui::SameLine();
+                ImGui::Checkbox("Incremental", &m_EnableIncrementalBake);
+                if (ImGui::IsItemHovered())
+                    ImGui::SetTooltip("Rebake only geometries whose effective bake inputs changed since they were built");
+
+                if (launchAsyncTask) {
+                    ImGui::SameLine();
+                    ImGui::Checkbox("Progressive", &m_EnableProgressiveBake);
+                    if (ImGui::BeginItemTooltip()) {
+                        ImGui::Text("Bake at subdivision level %u first, then refine to the target level in the background", OMM_PROGRESSIVE_COARSE_SUBDIVISION_LEVEL);
+                        ImGui::EndTooltip();
+                    }
+                }
 
-                if (isAsyncActive)
-                    ImGui::ProgressBar(float(m_OmmUpdateProgress) / float(m_OmmAlphaGeometry.size()));
+                const char* bakeStage = m_OmmBakeStage.load();
+                if (isAsyncActive) {
+                    char progressText[64];
+                    snprintf(progressText, sizeof(progressText), "%s: [%u / %zu]", bakeStage ? bakeStage : "", m_OmmUpdateProgress, m_OmmAlphaGeometry.size());
+                    ImGui::ProgressBar(float(m_OmmUpdateProgress) / float(m_OmmAlphaGeometry.size()), ImVec2(-FLT_MIN, 0.0f), progressText);
+                    ImGui::SameLine();
+                    if (ImGui::Button("Cancel")) {
+                        m_OmmBakeCancel = true;
+                        isRestartPending = false;
+                    }
+                } else if (bakeStage)
+                    ImGui::Text("Last Bake: %s [%u / %zu geometries rebaked]", bakeStage, m_OmmBakeDirtyNum.load(), m_OmmAlphaGeometry.size());
             }
             ++frameId;
         }
@@ -0,0 +1,402 @@
+// © 2022 NVIDIA Corporation
+
+// Headless OMM baker. Loads a scene the same way the sample does, bakes all alpha tested geometry with the cpu baker
+// and appends the result to "_OmmCache/<scene>", which the sample picks up with "Use OMM Cache" and the same settings.
+// Baker inputs are prepared by the sample's code (see OmmBakeInputs.h), so entries match a full bake in the sample.
+// Neither a window nor a device is created.
+// Large scenes can be split across machines with "--shard=<index>/<count>": every job bakes a deterministic, cost balanced
+// part of the geometry into its own file, and "--merge" combines the shard files into the cache file afterwards.
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <map>
+#include <numeric>
+#include <string>
+#include <vector>
+
+#include "VisibilityMasks/OmmBakeInputs.h"
+
+struct BakeToolSettings {
+    std::string sceneFile = "Bistro/BistroExterior.gltf";
+    std::string cacheFolder = "_OmmCache";
+    ommhelper::OmmBakeDesc bakeDesc = {};
+    uint32_t shardIndex = 0;
+    uint32_t shardNum = 1;
+    bool merge = false;
+};
+
+struct BakeToolGeometry {
+    ommhelper::OmmBakeGeometryDesc bakeDesc;
+    std::vector<uint8_t> uvData;
+    std::vector<uint8_t> indexData;
+    uint32_t meshIndex;
+    uint32_t materialIndex;
+    uint32_t alphaSourceIndex;
+    uint64_t meshContentHash; // cache key, as in the sample
+    uint64_t textureContentHash;
+    uint64_t cost; // estimated, used for shard balancing only
+};
+
+struct BakeToolAlphaSource { // same grouping and crop as AlphaSource in the sample: geometries whose baked mips have identical content
+    ommhelper::AlphaCrop crop;
+    float uvMin[2];
+    float uvMax[2];
+    uint32_t textureIndex;
+    uint32_t mipOffset;
+    uint32_t mipNum;
+};
+
+static void PrintUsage() {
+    printf(
+        "Usage: OMMBakeTool [options]\n"
+        "  --scene=<path>           scene relative to '_Data/Scenes' (default: Bistro/BistroExterior.gltf)\n"
+        "  --cache=<folder>         cache folder (default: _OmmCache)\n"
+        "  --level=<n>              max subdivision level (default: 9)\n"
+        "  --format=<name>          OC1_2_STATE or OC1_4_STATE (default: OC1_4_STATE)\n"
+        "  --filter=<name>          nearest or linear (default: linear)\n"
+        "  --mipBias=<n>            (default: 0)\n"
+        "  --mipCount=<n>           (default: 1)\n"
+        "  --scale=<f>              dynamic subdivision scale (default: 1.0)\n"
+        "  --autoLevel              per geometry level from texel density, up to --level\n"
+        "  --sceneDeduplication     bake geometries sharing a texture as one set of unique triangles\n"
+        "  --nearDuplicates         enable near duplicate detection\n"
+        "  --shard=<index>/<count>  bake only this part of the scene into '<cache>/<scene>.shard<index>-<count>'\n"
+        "  --merge                  merge all shard files of the scene into the cache file and exit\n"
+        "  --help                   print this message\n"
+        "Bake settings must match the sample's cpu baker settings for the cache to be used.\n");
+}
+
+static bool ParseArguments(int argc, char** argv, BakeToolSettings& settings) {
+    ommhelper::OmmBakeDesc& bakeDesc = settings.bakeDesc;
+    bakeDesc.type = ommhelper::OmmBakerType::CPU;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string argument = argv[i];
+        size_t separator = argument.find('=');
+        std::string name = argument.substr(0, separator);
+        std::string value = separator == std::string::npos ? "" : argument.substr(separator + 1);
+
+        if (name == "--help")
+            return false;
+        else if (name == "--scene")
+            settings.sceneFile = value;
+        else if (name == "--cache")
+            settings.cacheFolder = value;
+        else if (name == "--level")
+            bakeDesc.subdivisionLevel = (uint32_t)std::stoul(value);
+        else if (name == "--mipBias")
+            bakeDesc.mipBias = (uint32_t)std::stoul(value);
+        else if (name == "--mipCount")
+            bakeDesc.mipCount = std::max((uint32_t)std::stoul(value), 1u);
+        else if (name == "--scale")
+            bakeDesc.dynamicSubdivisionScale = std::stof(value);
+        else if (name == "--format" && (value == "OC1_2_STATE" || value == "OC1_4_STATE"))
+            bakeDesc.format = value == "OC1_2_STATE" ? ommhelper::OmmFormats::OC1_2_STATE : ommhelper::OmmFormats::OC1_4_STATE;
+        else if (name == "--filter" && (value == "nearest" || value == "linear"))
+            bakeDesc.filter = value == "nearest" ? ommhelper::OmmBakeFilter::Nearest : ommhelper::OmmBakeFilter::Linear;
+        else if (name == "--autoLevel")
+            bakeDesc.enableAutoSubdivisionLevel = true;
+        else if (name == "--sceneDeduplication")
+            bakeDesc.cpuFlags.enableSceneDeduplication = true;
+        else if (name == "--nearDuplicates")
+            bakeDesc.cpuFlags.enableNearDuplicateDetection = true;
+        else if (name == "--shard") {
+            if (sscanf(value.c_str(), "%u/%u", &settings.shardIndex, &settings.shardNum) != 2 || settings.shardIndex >= settings.shardNum) {
+                printf("[FAIL] Invalid shard: {%s}\n", argv[i]);
+                return false;
+            }
+        }
+        else if (name == "--merge")
+            settings.merge = true;
+        else {
+            printf("[FAIL] Unknown argument: {%s}\n", argv[i]);
+            return false;
+        }
+    }
+    return true;
+}
+
+static std::vector<size_t> SelectShard(const std::vector<BakeToolGeometry>& geometries, uint32_t shardIndex, uint32_t shardNum) {
+    // Longest processing time first: the most expensive geometry goes to the least loaded shard. Depends only on the scene
+    // and the settings, so every job computes the same partition without talking to the others
+    std::vector<size_t> order(geometries.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return geometries[a].cost > geometries[b].cost; });
+
+    std::vector<uint64_t> loads(shardNum, 0);
+    std::vector<size_t> result;
+    for (size_t i : order) {
+        size_t shard = std::min_element(loads.begin(), loads.end()) - loads.begin();
+        loads[shard] += geometries[i].cost;
+        if (shard == shardIndex)
+            result.push_back(i);
+    }
+    std::sort(result.begin(), result.end()); // back to scene order
+    return result;
+}
+
+static int MergeShards(const BakeToolSettings& settings, const std::string& sceneName) {
+    std::string cacheFilename = settings.cacheFolder + "/" + sceneName;
+    std::string prefix = sceneName + ".shard";
+
+    std::vector<std::string> shardFilenames;
+    std::error_code error;
+    for (const std::filesystem::directory_entry& entry : std::filesystem::directory_iterator(settings.cacheFolder, error)) {
+        std::string filename = entry.path().filename().string();
+        if (entry.is_regular_file() && filename.compare(0, prefix.size(), prefix) == 0 && entry.path().extension() != ".tmp")
+            shardFilenames.push_back(entry.path().string());
+    }
+    std::sort(shardFilenames.begin(), shardFilenames.end()); // deterministic order, the first copy of a duplicate wins
+
+    if (shardFilenames.empty()) {
+        printf("[FAIL] No shard files found for {%s}\n", cacheFilename.c_str());
+        return 1;
+    }
+
+    size_t entryNum = ommhelper::OmmCaching::MergeCacheFiles(cacheFilename.c_str(), shardFilenames);
+    if (entryNum == 0)
+        return 1;
+
+    printf("[OMM] %zu shard files merged, %zu entries in {%s}. Shard files can be deleted now\n", shardFilenames.size(), entryNum, cacheFilename.c_str());
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    BakeToolSettings settings;
+    if (!ParseArguments(argc, argv, settings)) {
+        PrintUsage();
+        return 1;
+    }
+    const ommhelper::OmmBakeDesc& bakeDesc = settings.bakeDesc;
+
+    size_t sceneNameBegin = settings.sceneFile.find_last_of('/');
+    sceneNameBegin = sceneNameBegin == std::string::npos ? 0 : sceneNameBegin + 1;
+    std::string sceneName = settings.sceneFile.substr(sceneNameBegin, settings.sceneFile.find_last_of('.') - sceneNameBegin);
+    if (settings.merge)
+        return MergeShards(settings, sceneName);
+
+    std::string mainCacheFilename = settings.cacheFolder + "/" + sceneName;
+    std::string cacheFilename = mainCacheFilename;
+    if (settings.shardNum > 1)
+        cacheFilename += ".shard" + std::to_string(settings.shardIndex) + "-" + std::to_string(settings.shardNum);
+
+    // The proxy scene goes first, as in the sample, so mesh and material IDs match
+    utils::Scene scene;
+    std::string sceneFile = utils::GetFullPath(settings.sceneFile, utils::DataFolder::SCENES);
+    if (!utils::LoadScene(utils::GetFullPath("Cubes/Cubes.gltf", utils::DataFolder::SCENES), scene, false) || !utils::LoadScene(sceneFile, scene, false)) {
+        printf("[FAIL] Unable to load scene: {%s}\n", sceneFile.c_str());
+        return 1;
+    }
+
+    std::map<uint32_t, ommhelper::OmmMaterialBakeParams> materialParams;
+    ommhelper::LoadMaterialBakeParams((sceneFile.substr(0, sceneFile.find_last_of('.')) + ".omm").c_str(), (uint32_t)scene.materials.size(), materialParams);
+
+    // Per geometry params and alpha sources are resolved over the whole scene, as in a full bake in the sample, so crops don't depend on the shard
+    std::vector<BakeToolGeometry> sceneGeometries;
+    std::vector<BakeToolAlphaSource> alphaSources;
+    std::map<uint64_t, uint32_t> textureHashToAlphaSource;
+    std::map<uint64_t, uint64_t> mipContentHashes; // texture index and mip id -> content hash
+    for (uint32_t instanceId : ommhelper::FilterOutAlphaTestedGeometry(scene)) {
+        const utils::Instance& instance = scene.instances[instanceId];
+        const utils::Material& material = scene.materials[instance.materialIndex];
+        const utils::Texture* texture = scene.textures[material.baseColorTexIndex];
+
+        static const ommhelper::OmmMaterialBakeParams defaultParams = {};
+        const auto& params = materialParams.find(instance.materialIndex);
+        const ommhelper::OmmMaterialBakeParams& param = params != materialParams.end() ? params->second : defaultParams;
+
+        BakeToolGeometry geometry = {};
+        geometry.meshIndex = instance.meshInstanceIndex;
+        geometry.materialIndex = instance.materialIndex;
+
+        ommhelper::OmmBakeGeometryDesc& desc = geometry.bakeDesc;
+        ommhelper::ResolveGeometryBakeParams(scene, geometry.meshIndex, geometry.materialIndex, param, bakeDesc, desc);
+        ommhelper::GetAlphaMipRange(texture, bakeDesc, desc.texture.mipOffset, desc.texture.mipNum);
+        desc.texture.format = nri::Format::R8_UNORM;
+
+        uint64_t mipHashes[OMM_MAX_MIP_NUM] = {};
+        for (uint32_t mip = 0; mip < desc.texture.mipNum; ++mip) {
+            uint32_t mipId = desc.texture.mipOffset + mip;
+            auto it = mipContentHashes.insert(std::make_pair(uint64_t(material.baseColorTexIndex) << 32 | uint64_t(mipId), uint64_t(0)));
+            if (it.second)
+                it.first->second = ommhelper::CalculateAlphaMipContentHash((const detexTexture*)texture->mips[mipId]);
+            mipHashes[mip] = it.first->second;
+        }
+        uint64_t textureHash = ommhelper::CalculateAlphaTextureContentHash(mipHashes, desc.texture.mipNum);
+        geometry.textureContentHash = textureHash;
+
+        const utils::Mesh& mesh = scene.meshes[geometry.meshIndex];
+        geometry.meshContentHash = ommhelper::CalculateMeshContentHash(scene, mesh);
+        float uvMin[2];
+        float uvMax[2];
+        ommhelper::GetMeshUvRange(scene, mesh, uvMin, uvMax);
+
+        const auto& it = textureHashToAlphaSource.find(textureHash);
+        bool isShared = false;
+        if (it != textureHashToAlphaSource.end()) { // hashes only select the candidate, the payload is compared before sharing
+            const BakeToolAlphaSource& candidate = alphaSources[it->second];
+            isShared = candidate.mipNum == desc.texture.mipNum && ommhelper::IsSameAlphaPayload(scene.textures[candidate.textureIndex], candidate.mipOffset, texture, desc.texture.mipOffset, desc.texture.mipNum);
+        }
+
+        geometry.alphaSourceIndex = isShared ? it->second : (uint32_t)alphaSources.size();
+        if (!isShared) {
+            if (it == textureHashToAlphaSource.end())
+                textureHashToAlphaSource.insert(std::make_pair(textureHash, geometry.alphaSourceIndex));
+
+            BakeToolAlphaSource source = {};
+            source.textureIndex = material.baseColorTexIndex;
+            source.mipOffset = desc.texture.mipOffset;
+            source.mipNum = desc.texture.mipNum;
+            memcpy(source.uvMin, uvMin, sizeof(uvMin));
+            memcpy(source.uvMax, uvMax, sizeof(uvMax));
+            alphaSources.push_back(source);
+        }
+
+        BakeToolAlphaSource& source = alphaSources[geometry.alphaSourceIndex];
+        for (uint32_t axis = 0; axis < 2; ++axis) {
+            source.uvMin[axis] = std::min(source.uvMin[axis], uvMin[axis]);
+            source.uvMax[axis] = std::max(source.uvMax[axis], uvMax[axis]);
+        }
+
+        const detexTexture* detexMip = (const detexTexture*)texture->mips[desc.texture.mipOffset];
+        uint64_t microTriangleNum = uint64_t(mesh.indexNum / 3) << (2 * std::min(desc.maxSubdivisionLevel, 12u));
+        geometry.cost = microTriangleNum + uint64_t(detexMip->width) * detexMip->height;
+
+        sceneGeometries.push_back(std::move(geometry));
+    }
+
+    for (BakeToolAlphaSource& source : alphaSources) {
+        const utils::Texture* texture = scene.textures[source.textureIndex];
+        uint32_t mipOffset = 0;
+        uint32_t mipNum = 0;
+        ommhelper::GetAlphaMipRange(texture, bakeDesc, mipOffset, mipNum);
+        source.crop = ommhelper::GetAlphaCrop(source.uvMin, source.uvMax, texture, mipOffset, mipNum);
+    }
+
+    // The partition is computed over the whole scene before the cache lookup, so it stays the same between resumed runs
+    std::vector<size_t> shardGeometries(sceneGeometries.size());
+    std::iota(shardGeometries.begin(), shardGeometries.end(), 0);
+    if (settings.shardNum > 1)
+        shardGeometries = SelectShard(sceneGeometries, settings.shardIndex, settings.shardNum);
+
+    // Geometry already present in the cache for these settings is skipped, so interrupted runs can be resumed
+    const uint64_t stateHash = ommhelper::OmmCaching::CalculateSateHash(bakeDesc);
+    std::vector<BakeToolGeometry> geometries;
+    size_t cachedNum = 0;
+    for (size_t i : shardGeometries) {
+        BakeToolGeometry& geometry = sceneGeometries[i];
+        uint64_t hash = ommhelper::OmmCaching::CalculateGeometryHash(geometry.meshIndex, geometry.materialIndex, geometry.meshContentHash, geometry.textureContentHash, geometry.bakeDesc, bakeDesc);
+        bool isCached = ommhelper::OmmCaching::LookForCache(cacheFilename.c_str(), stateHash, hash);
+        isCached = isCached || (settings.shardNum > 1 && ommhelper::OmmCaching::LookForCache(mainCacheFilename.c_str(), stateHash, hash));
+        if (isCached) {
+            ++cachedNum;
+            continue;
+        }
+        geometries.push_back(std::move(geometry));
+    }
+
+    if (settings.shardNum > 1)
+        printf("[OMM] %s: shard %u of %u, %zu of %zu geometries\n", sceneName.c_str(), settings.shardIndex, settings.shardNum, shardGeometries.size(), sceneGeometries.size());
+    printf("[OMM] %s: %zu geometries to bake, %zu already cached\n", sceneName.c_str(), geometries.size(), cachedNum);
+    if (geometries.empty())
+        return 0;
+
+    ommhelper::OmmCaching::CreateFolder(settings.cacheFolder.c_str());
+    ommhelper::OmmCpuBaker baker;
+    baker.Initialize();
+
+    // Geometries are baked per alpha source, so only one decoded source is alive at a time
+    std::stable_sort(geometries.begin(), geometries.end(), [](const BakeToolGeometry& a, const BakeToolGeometry& b) { return a.alphaSourceIndex < b.alphaSourceIndex; });
+
+    auto bakeBegin = std::chrono::steady_clock::now();
+    size_t bakedNum = 0;
+    for (size_t groupBegin = 0; groupBegin < geometries.size();) {
+        size_t groupEnd = groupBegin;
+        while (groupEnd < geometries.size() && geometries[groupEnd].alphaSourceIndex == geometries[groupBegin].alphaSourceIndex)
+            ++groupEnd;
+
+        const BakeToolAlphaSource& source = alphaSources[geometries[groupBegin].alphaSourceIndex];
+        const utils::Texture* texture = scene.textures[source.textureIndex];
+        ommhelper::AlphaRegion regions[OMM_MAX_MIP_NUM];
+        std::vector<uint8_t> alphaMips[OMM_MAX_MIP_NUM]; // R8 alpha of the cropped regions, shared by the group
+        std::vector<ommhelper::OmmBakeGeometryDesc*> queue;
+        for (size_t i = groupBegin; i < groupEnd; ++i) {
+            BakeToolGeometry& geometry = geometries[i];
+            ommhelper::OmmBakeGeometryDesc& desc = geometry.bakeDesc;
+            const utils::Mesh& mesh = scene.meshes[geometry.meshIndex];
+
+            nri::Format indexFormat = ommhelper::EncodeOmmIndices(scene.indices.data() + mesh.indexOffset, mesh.indexNum, geometry.indexData);
+            nri::Format uvFormat = ommhelper::IsAlphaCropped(source.crop)
+                ? ommhelper::RemapUvsToAlphaCrop(source.crop, scene.unpackedVertices.data() + mesh.vertexOffset, mesh.vertexNum, geometry.uvData)
+                : ommhelper::EncodeOmmMeshUvs(scene, mesh, texture, geometry.uvData);
+
+            desc.uvs.nriBufferOrPtr.ptr = geometry.uvData.data();
+            desc.uvs.numElements = mesh.vertexNum;
+            desc.uvs.stride = ommhelper::GetOmmUvStride(uvFormat);
+            desc.uvs.format = uvFormat;
+            desc.uvs.bufferSize = geometry.uvData.size();
+
+            desc.indices.nriBufferOrPtr.ptr = geometry.indexData.data();
+            desc.indices.numElements = mesh.indexNum;
+            desc.indices.stride = ommhelper::GetOmmIndexStride(indexFormat);
+            desc.indices.format = indexFormat;
+            desc.indices.bufferSize = geometry.indexData.size();
+
+            for (uint32_t mip = 0; mip < desc.texture.mipNum; ++mip) {
+                uint32_t mipId = desc.texture.mipOffset + mip;
+                const detexTexture* detexMip = (const detexTexture*)texture->mips[mipId];
+                ommhelper::AlphaRegion& region = regions[mip];
+                std::vector<uint8_t>& alpha = alphaMips[mip];
+                if (alpha.empty()) {
+                    region = ommhelper::GetAlphaRegion(source.crop, detexMip, mipId);
+                    alpha.resize(size_t(region.width) * size_t(region.height));
+                    ommhelper::DecodeAlphaRows(detexMip, region, alpha.data(), 0, region.height);
+                }
+
+                ommhelper::MipDesc& mipDesc = desc.texture.mips[mip];
+                mipDesc.nriTextureOrPtr.ptr = alpha.data();
+                mipDesc.width = region.width;
+                mipDesc.height = region.height;
+                mipDesc.rowPitch = region.width;
+            }
+            queue.push_back(&desc);
+        }
+
+        baker.Bake(queue.data(), queue.size(), bakeDesc);
+        baker.PostBakeCleanUp();
+
+        for (size_t i = groupBegin; i < groupEnd; ++i) {
+            BakeToolGeometry& geometry = geometries[i];
+            ommhelper::OmmBakeGeometryDesc& desc = geometry.bakeDesc;
+
+            bool isDataValid = true;
+            ommhelper::OmmCaching::OmmData data = {};
+            for (uint32_t j = 0; j < (uint32_t)ommhelper::OmmDataLayout::CpuMaxNum; ++j) {
+                data.data[j] = desc.outData[j].data();
+                data.sizes[j] = desc.outData[j].size();
+                isDataValid &= data.sizes[j] > 0;
+            }
+            if (isDataValid) {
+                uint64_t hash = ommhelper::OmmCaching::CalculateGeometryHash(geometry.meshIndex, geometry.materialIndex, geometry.meshContentHash, geometry.textureContentHash, desc, bakeDesc);
+                ommhelper::OmmCaching::SaveMasksToDisc(cacheFilename.c_str(), data, stateHash, hash, (uint16_t)desc.outOmmIndexFormat);
+                ++bakedNum;
+            }
+
+            for (std::vector<uint8_t>& output : desc.outData)
+                std::vector<uint8_t>().swap(output);
+            std::vector<uint8_t>().swap(geometry.uvData);
+            std::vector<uint8_t>().swap(geometry.indexData);
+        }
+
+        printf("[OMM] Baked %zu / %zu\n", groupEnd, geometries.size());
+        groupBegin = groupEnd;
+    }
+
+    baker.Destroy();
+
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - bakeBegin).count();
+    printf("[OMM] %zu geometries baked in %.2f s into {%s}\n", bakedNum, seconds, cacheFilename.c_str());
+    return 0;
+}
@@ -0,0 +1,174 @@
+// © 2022 NVIDIA Corporation
+
+// Microbenchmark of the GPU baker descriptor lookups. Descriptor sets: every dispatch hashes its resource array and looks
+// the hash up once in UpdateDescriptorPool() (inserting it on a miss) and once more in PrepareDispatch(). Views: every
+// resource of a dispatch is looked up in GetDescriptor(). Compares the previous std::map lookups against FlatHashMap
+// with HashBytes and ViewKeyHasher. Synthetic, no device is created.
+// Built only with "OMM_BUILD_BENCHMARKS=ON".
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "VisibilityMasks/OmmBakerIntegration.h"
+
+struct BenchSettings {
+    uint32_t geometryNum = 10000;
+    uint32_t dispatchNum = 12; // per geometry
+    uint32_t resourceNum = 8;  // per dispatch
+    uint32_t repeatNum = 5;    // the fastest run is reported
+};
+
+static uint64_t ComputeHashFnv(const void* key, uint32_t len, uint32_t geometryId) { // the hash used before HashBytes
+    const uint8_t* p = (uint8_t*)key;
+    uint64_t result = 14695981039346656037ull - geometryId;
+    while (len--)
+        result = (result ^ (*p++)) * 1099511628211ull;
+
+    return result;
+}
+
+static uint64_t ComputeHashWords(const void* key, uint32_t len, uint32_t geometryId) { // same as ComputeHash() in OmmBakerIntegration.cpp
+    return HashBytes(key, len, 14695981039346656037ull - geometryId);
+}
+
+struct DescriptorSetKeyHasher {
+    uint64_t operator()(uint64_t key) const {
+        return key;
+    }
+};
+
+static uint64_t GetViewKeyPacked(const ommGpuResource& resource, uint32_t geometryId) { // the view key used before ViewKey
+    bool isTransientPool = resource.type == ommGpuResourceType_TRANSIENT_POOL_BUFFER;
+    uint64_t key = isTransientPool ? 0 : geometryId + 1;
+    key |= uint64_t(resource.type) << 32ull;
+    key |= uint64_t(resource.stateNeeded) << 40ull;
+    key |= uint64_t(resource.indexInPool) << 48ull;
+    return key;
+}
+
+static ViewKey GetViewKey(const ommGpuResource& resource, uint32_t geometryId) { // transient pool buffers are shared, the rest are per geometry buffers
+    bool isTransientPool = resource.type == ommGpuResourceType_TRANSIENT_POOL_BUFFER;
+    uint64_t bufferId = (isTransientPool ? 0 : uint64_t(geometryId + 1) << 24) | uint64_t(resource.type) << 16 | resource.indexInPool;
+    return ViewKey((const void*)(uintptr_t)((bufferId + 1) << 8), 0, 4096, nri::Format::UNKNOWN, (uint32_t)resource.stateNeeded); // a fake, aligned buffer address
+}
+
+template <typename Hash, typename Find, typename Insert>
+static double RunLookups(const BenchSettings& settings, const std::vector<ommGpuResource>& resources, Hash hash, Find find, Insert insert, size_t& outChecksum) { // returns ns per dispatch
+    auto begin = std::chrono::steady_clock::now();
+    const uint32_t keySize = settings.resourceNum * sizeof(ommGpuResource);
+    for (uint32_t geometryId = 0; geometryId < settings.geometryNum; ++geometryId) {
+        for (uint32_t dispatch = 0; dispatch < settings.dispatchNum; ++dispatch) {
+            const ommGpuResource* dispatchResources = resources.data() + size_t(dispatch) * settings.resourceNum;
+
+            uint64_t key = hash(dispatchResources, keySize, geometryId); // UpdateDescriptorPool
+            if (!find(key))
+                insert(key);
+
+            key = hash(dispatchResources, keySize, geometryId); // PrepareDispatch
+            outChecksum += find(key) ? 1 : 0;
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - begin).count() / (double(settings.geometryNum) * settings.dispatchNum);
+}
+
+template <typename Key, typename GetKey, typename Find, typename Insert>
+static double RunViewLookups(const BenchSettings& settings, const std::vector<ommGpuResource>& resources, GetKey getKey, Find find, Insert insert, size_t& outChecksum) { // returns ns per dispatch
+    auto begin = std::chrono::steady_clock::now();
+    for (uint32_t geometryId = 0; geometryId < settings.geometryNum; ++geometryId) {
+        for (uint32_t dispatch = 0; dispatch < settings.dispatchNum; ++dispatch) {
+            const ommGpuResource* dispatchResources = resources.data() + size_t(dispatch) * settings.resourceNum;
+            for (uint32_t i = 0; i < settings.resourceNum; ++i) { // GetDescriptor
+                ommGpuResource resource = dispatchResources[i];
+                if (resource.type != ommGpuResourceType_TRANSIENT_POOL_BUFFER)
+                    resource.indexInPool = 0; // only transient pool buffers are addressed by the pool slot
+
+                Key key = getKey(resource, geometryId);
+                if (find(key))
+                    ++outChecksum;
+                else
+                    insert(key);
+            }
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - begin).count() / (double(settings.geometryNum) * settings.dispatchNum);
+}
+
+int main(int argc, char** argv) {
+    BenchSettings settings;
+    for (int i = 1; i < argc; ++i) {
+        std::string argument = argv[i];
+        size_t separator = argument.find('=');
+        std::string name = argument.substr(0, separator);
+        uint32_t value = separator == std::string::npos ? 0 : (uint32_t)std::stoul(argument.substr(separator + 1));
+
+        if (name == "--geometries")
+            settings.geometryNum = std::max(value, 1u);
+        else if (name == "--dispatches")
+            settings.dispatchNum = std::max(value, 1u);
+        else if (name == "--resources")
+            settings.resourceNum = std::max(value, 1u);
+        else if (name == "--repeat")
+            settings.repeatNum = std::max(value, 1u);
+        else {
+            printf("Usage: OMMLookupBench [--geometries=<n>] [--dispatches=<n>] [--resources=<n>] [--repeat=<n>]\n");
+            return 1;
+        }
+    }
+
+    // Resource arrays of one geometry, every geometry binds the same pool slots with its own hash seed
+    std::vector<ommGpuResource> resources(size_t(settings.dispatchNum) * settings.resourceNum);
+    for (size_t i = 0; i < resources.size(); ++i) {
+        ommGpuResource& resource = resources[i];
+        memset(&resource, 0, sizeof(resource));
+        resource.stateNeeded = i % 2 ? ommGpuDescriptorType_RawBufferWrite : ommGpuDescriptorType_RawBufferRead;
+        resource.type = (ommGpuResourceType)(i % settings.resourceNum);
+        resource.indexInPool = (uint16_t)(i / settings.resourceNum);
+    }
+
+    double treeTime = 0.0;
+    double flatTime = 0.0;
+    double treeViewTime = 0.0;
+    double flatViewTime = 0.0;
+    size_t checksum = 0;
+    for (uint32_t repeat = 0; repeat < settings.repeatNum; ++repeat) {
+        std::map<uint64_t, nri::DescriptorSet*> treeSets;
+        double time = RunLookups(settings, resources, ComputeHashFnv,
+            [&](uint64_t key) { return treeSets.find(key) != treeSets.end(); },
+            [&](uint64_t key) { treeSets.insert(std::make_pair(key, nullptr)); }, checksum);
+        treeTime = repeat ? std::min(treeTime, time) : time;
+
+        FlatHashMap<uint64_t, nri::DescriptorSet*, DescriptorSetKeyHasher> flatSets;
+        time = RunLookups(settings, resources, ComputeHashWords,
+            [&](uint64_t key) { return flatSets.Find(key) != nullptr; },
+            [&](uint64_t key) { flatSets.Insert(key, nullptr); }, checksum);
+        flatTime = repeat ? std::min(flatTime, time) : time;
+
+        std::map<uint64_t, nri::Descriptor*> treeViews;
+        time = RunViewLookups<uint64_t>(settings, resources, GetViewKeyPacked,
+            [&](uint64_t key) { return treeViews.find(key) != treeViews.end(); },
+            [&](uint64_t key) { treeViews.insert(std::make_pair(key, nullptr)); }, checksum);
+        treeViewTime = repeat ? std::min(treeViewTime, time) : time;
+
+        FlatHashMap<ViewKey, nri::Descriptor*, ViewKeyHasher> flatViews;
+        time = RunViewLookups<ViewKey>(settings, resources, GetViewKey,
+            [&](const ViewKey& key) { return flatViews.Find(key) != nullptr; },
+            [&](const ViewKey& key) { flatViews.Insert(key, nullptr); }, checksum);
+        flatViewTime = repeat ? std::min(flatViewTime, time) : time;
+    }
+
+    printf("%u geometries x %u dispatches x %u resources, fastest of %u runs\n", settings.geometryNum, settings.dispatchNum, settings.resourceNum, settings.repeatNum);
+    printf("Descriptor sets:\n");
+    printf("  std::map + byte-wise FNV:   %.1f ns per dispatch\n", treeTime);
+    printf("  FlatHashMap + HashBytes:    %.1f ns per dispatch\n", flatTime);
+    printf("Views:\n");
+    printf("  std::map + packed key:      %.1f ns per dispatch\n", treeViewTime);
+    printf("  FlatHashMap + ViewKey:      %.1f ns per dispatch\n", flatViewTime);
+    printf("  (checksum %zu)\n", checksum);
+    return 0;
+}
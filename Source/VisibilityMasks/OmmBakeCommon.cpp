@@ -0,0 +1,976 @@
+/*
+Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+
+NVIDIA CORPORATION and its licensors retain all intellectual property
+and proprietary rights in and to this software, related documentation
+and any modifications thereto. Any use, reproduction, disclosure or
+distribution of this software and related documentation without an express
+license agreement from NVIDIA CORPORATION is strictly prohibited.
+*/
+
+#include "OmmBakeCommon.h"
+#include "OmmBakerIntegration.h" // HashBytes
+#include <filesystem>
+#include <limits>
+#include <set>
+#include <sstream>
+
+#ifdef _WIN32
+#    include <windows.h>
+#else
+#    include <fcntl.h>
+#    include <sys/mman.h>
+#    include <sys/stat.h>
+#    include <unistd.h>
+#endif
+
+namespace ommhelper {
+#pragma region[ Utils ]
+
+inline ommCpuTextureFormat GetOmmBakerTextureFormat(nri::Format format) {
+    switch (format) {
+        case nri::Format::R32_SFLOAT:
+            return ommCpuTextureFormat_FP32;
+        case nri::Format::R8_UNORM:
+            return ommCpuTextureFormat_UNORM8;
+        default:
+            printf("[FAIL] Unknown texture format passed to Cpu Baker!\n");
+            std::abort();
+    }
+}
+
+inline ommIndexFormat GetOmmBakerIndexFormat(nri::Format format) {
+    switch (format) {
+        case nri::Format::R8_UINT:
+            return ommIndexFormat_UINT_8;
+        case nri::Format::R16_UINT:
+            return ommIndexFormat_UINT_16;
+        case nri::Format::R32_UINT:
+            return ommIndexFormat_UINT_32;
+        default:
+            printf("[FAIL] Unknown index format passed to Cpu Baker!\n");
+            std::abort();
+    }
+}
+
+inline ommTexCoordFormat GetOmmBakerUvFormat(nri::Format format) {
+    switch (format) {
+        case nri::Format::RG16_SFLOAT:
+            return ommTexCoordFormat_UV16_FLOAT;
+        case nri::Format::RG32_SFLOAT:
+            return ommTexCoordFormat_UV32_FLOAT;
+        case nri::Format::RG16_UNORM:
+            return ommTexCoordFormat_UV16_UNORM;
+        default:
+            printf("[FAIL] Unknown UV format passed to Cpu Baker!\n");
+            std::abort();
+    }
+}
+
+inline ommFormat GetOmmFormat(OmmFormats format) {
+    switch (format) {
+        case OmmFormats::OC1_2_STATE:
+            return ommFormat_OC1_2_State;
+        case OmmFormats::OC1_4_STATE:
+            return ommFormat_OC1_4_State;
+        default:
+            printf("[FAIL] Unknown OMM format passed to Cpu Baker!\n");
+            std::abort();
+    }
+}
+
+inline nri::Format GetNriIndexFormat(ommIndexFormat format) {
+    switch (format) {
+        case ommIndexFormat_UINT_8:
+            return nri::Format::R8_UINT;
+        case ommIndexFormat_UINT_16:
+            return nri::Format::R16_UINT;
+        case ommIndexFormat_UINT_32:
+            return nri::Format::R32_UINT;
+        default:
+            printf("[FAIL] Unknown Index format returned from Cpu Baker!\n");
+            std::abort();
+    }
+}
+
+inline ommTextureAddressMode GetOmmAddressingMode(nri::AddressMode mode) {
+    switch (mode) {
+        case nri::AddressMode::REPEAT:
+            return ommTextureAddressMode_Wrap;
+        case nri::AddressMode::MIRRORED_REPEAT:
+            return ommTextureAddressMode_Mirror;
+        case nri::AddressMode::CLAMP_TO_EDGE:
+            return ommTextureAddressMode_Clamp;
+        case nri::AddressMode::CLAMP_TO_BORDER:
+            return ommTextureAddressMode_Border;
+        default:
+            printf("[FAIL] Ivalid AddressMode passed to Cpu Baker!\n");
+            std::abort();
+    }
+}
+
+#pragma endregion
+
+#pragma region[ CPU baking ]
+
+void OmmCpuBaker::Initialize() {
+    ommMessageInterface log;
+    log.userArg = nullptr;
+    log.messageCallback = [](ommMessageSeverity severity, const char* message, void* /* userArg*/) {
+        const char* severityStr = "";
+        switch (severity) {
+            case ommMessageSeverity_Info:
+                severityStr = "INFO";
+                break;
+            case ommMessageSeverity_PerfWarning:
+                severityStr = "WARNING";
+                break;
+            case ommMessageSeverity_Error:
+                severityStr = "ERROR";
+                break;
+            case ommMessageSeverity_Fatal:
+                severityStr = "FATAL";
+                break;
+            default:
+                severityStr = "UNKNOWN";
+                break;
+        }
+        printf("[OMM][%s]: %s\n", severityStr, message);
+    };
+    ommBakerCreationDesc desc = ommBakerCreationDescDefault();
+    desc.messageInterface = log;
+    desc.type = ommBakerType_CPU;
+    if (ommCreateBaker(&desc, &m_Baker) != ommResult_SUCCESS) {
+        printf("[FAIL]: ommCreateOpacityMicromapBaker\n");
+        std::abort();
+    }
+}
+
+void OmmCpuBaker::Destroy() {
+    PostBakeCleanUp();
+    ommDestroyBaker(m_Baker);
+    m_Baker = 0;
+}
+
+static ommCpuBakeFlags GetCpuBakeFlags(CpuBakerFlags cpuBakerFlags) {
+    uint32_t result = 0;
+    result |= cpuBakerFlags.enableInternalThreads ? uint32_t(ommCpuBakeFlags_EnableInternalThreads) : 0;
+    result |= !cpuBakerFlags.enableSpecialIndices ? uint32_t(ommCpuBakeFlags_DisableSpecialIndices) : 0;
+    result |= !cpuBakerFlags.enableDuplicateDetection ? uint32_t(ommCpuBakeFlags_DisableDuplicateDetection) : 0;
+    result |= cpuBakerFlags.enableNearDuplicateDetection ? uint32_t(ommCpuBakeFlags_EnableNearDuplicateDetection) : 0;
+    result |= cpuBakerFlags.force32bitIndices ? uint32_t(ommCpuBakeFlags_Force32BitIndices) : 0;
+    result |= cpuBakerFlags.allow8bitIndices ? uint32_t(ommCpuBakeFlags_Allow8BitIndices) : 0;
+    return ommCpuBakeFlags(result);
+}
+
+void OmmCpuBaker::Bake(OmmBakeGeometryDesc** queue, const size_t count, const OmmBakeDesc& desc, const OmmCancelToken* cancel) {
+    if (desc.cpuFlags.enableSceneDeduplication && count > 1) {
+        BakeDeduplicated(queue, count, desc, cancel);
+        return;
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        if (cancel && cancel->load(std::memory_order_relaxed))
+            return;
+
+        OmmBakeGeometryDesc& instance = *queue[i];
+
+        InputTexture& inTexture = instance.texture;
+        const MipDesc& firstMip = inTexture.mips[0];
+        CpuTextureKey textureKey = {firstMip.nriTextureOrPtr.ptr, firstMip.width, firstMip.height, inTexture.mipNum, (uint32_t)inTexture.format, instance.alphaCutoff};
+
+        ommCpuTexture vmTex = 0;
+        const auto& cachedTexture = m_Textures.find(textureKey);
+        if (cachedTexture != m_Textures.end())
+            vmTex = cachedTexture->second;
+        else {
+            ommCpuTextureMipDesc texuteMipDescs[OMM_MAX_MIP_NUM] = {};
+            for (uint32_t mip = 0; mip < inTexture.mipNum; ++mip) {
+                ommCpuTextureMipDesc& texuteMipDesc = texuteMipDescs[mip];
+                texuteMipDesc = ommCpuTextureMipDescDefault();
+                MipDesc& inMipDesc = inTexture.mips[mip];
+                texuteMipDesc.width = inMipDesc.width;
+                texuteMipDesc.height = inMipDesc.height;
+                texuteMipDesc.textureData = inMipDesc.nriTextureOrPtr.ptr;
+            }
+
+            ommCpuTextureDesc textureDesc = ommCpuTextureDescDefault();
+            textureDesc.mipCount = inTexture.mipNum;
+            textureDesc.mips = texuteMipDescs;
+            textureDesc.format = GetOmmBakerTextureFormat(inTexture.format);
+            textureDesc.alphaCutoff = instance.alphaCutoff;
+
+            if (ommCpuCreateTexture(m_Baker, &textureDesc, &vmTex) != ommResult_SUCCESS) {
+                printf("[FAIL]: ommCpuCreateTexture\n");
+                std::abort();
+            }
+            m_Textures.insert(std::make_pair(textureKey, vmTex));
+        }
+
+        ommCpuBakeInputDesc bakeDesc = ommCpuBakeInputDescDefault();
+        bakeDesc.texture = vmTex;
+        bakeDesc.alphaMode = ommAlphaMode(instance.alphaMode);
+        bakeDesc.runtimeSamplerDesc.addressingMode = GetOmmAddressingMode(inTexture.addressingMode);
+        bakeDesc.runtimeSamplerDesc.borderAlpha = instance.borderAlpha;
+        bakeDesc.runtimeSamplerDesc.filter = ommTextureFilterMode(desc.filter);
+        bakeDesc.maxSubdivisionLevel = (uint8_t)instance.maxSubdivisionLevel;
+        bakeDesc.alphaCutoff = instance.alphaCutoff;
+        bakeDesc.dynamicSubdivisionScale = desc.dynamicSubdivisionScale;
+
+        InputBuffer& inIndices = instance.indices;
+        bakeDesc.indexFormat = GetOmmBakerIndexFormat(inIndices.format);
+        bakeDesc.indexBuffer = (uint8_t*)inIndices.nriBufferOrPtr.ptr;
+        bakeDesc.indexCount = (uint32_t)inIndices.numElements;
+
+        InputBuffer& inUvs = instance.uvs;
+        bakeDesc.texCoords = (uint8_t*)inUvs.nriBufferOrPtr.ptr;
+        bakeDesc.texCoordFormat = GetOmmBakerUvFormat(inUvs.format);
+
+        bakeDesc.bakeFlags = GetCpuBakeFlags(desc.cpuFlags);
+        bakeDesc.format = GetOmmFormat(instance.format);
+
+        ommCpuBakeResult bakeResult;
+        ommResult res = ommCpuBake(m_Baker, &bakeDesc, &bakeResult);
+
+        if (res == ommResult_WORKLOAD_TOO_BIG) {
+            printf("[WARNING]: ommCpuBakeOpacityMicromap - Workload size is too big.\n");
+            return;
+        }
+
+        if (res != ommResult_SUCCESS) {
+            printf("[FAIL]: ommCpuBakeVisibilityMap\n");
+            std::abort();
+        }
+
+        const ommCpuBakeResultDesc* resDesc = nullptr;
+        res = ommCpuGetBakeResultDesc(bakeResult, &resDesc);
+
+        if (res != ommResult_SUCCESS) {
+            printf("[FAIL]: ommCpuGetBakeResultDesc\n");
+            std::abort();
+        }
+
+        if (resDesc->arrayData) {
+            instance.outData[(uint32_t)OmmDataLayout::ArrayData].resize(resDesc->arrayDataSize);
+            memcpy(instance.outData[(uint32_t)OmmDataLayout::ArrayData].data(), resDesc->arrayData, resDesc->arrayDataSize);
+
+            size_t ommDescArraySize = resDesc->descArrayCount * sizeof(ommCpuOpacityMicromapDesc);
+            instance.outData[(uint32_t)OmmDataLayout::DescArray].resize(ommDescArraySize);
+            memcpy(instance.outData[(uint32_t)OmmDataLayout::DescArray].data(), resDesc->descArray, ommDescArraySize);
+
+            size_t ommDescArrayHistogramSize = resDesc->descArrayHistogramCount * sizeof(ommCpuOpacityMicromapDesc);
+            instance.outData[(uint32_t)OmmDataLayout::DescArrayHistogram].resize(ommDescArrayHistogramSize);
+            memcpy(instance.outData[(uint32_t)OmmDataLayout::DescArrayHistogram].data(), resDesc->descArrayHistogram, ommDescArrayHistogramSize);
+            instance.outDescArrayHistogramCount = resDesc->descArrayHistogramCount;
+
+            size_t ommIndexHistogramSize = resDesc->indexHistogramCount * sizeof(ommCpuOpacityMicromapDesc);
+            instance.outData[(uint32_t)OmmDataLayout::IndexHistogram].resize(ommIndexHistogramSize);
+            memcpy(instance.outData[(uint32_t)OmmDataLayout::IndexHistogram].data(), resDesc->indexHistogram, ommIndexHistogramSize);
+            instance.outIndexHistogramCount = resDesc->indexHistogramCount;
+
+            size_t stride = resDesc->indexFormat == ommIndexFormat_UINT_8 ? sizeof(uint8_t) : resDesc->indexFormat == ommIndexFormat_UINT_16 ? sizeof(uint16_t) : sizeof(uint32_t);
+            size_t indexDataSize = resDesc->indexCount * stride;
+            instance.outOmmIndexFormat = GetNriIndexFormat(resDesc->indexFormat);
+            instance.outOmmIndexStride = (uint32_t)stride;
+            instance.outData[(uint32_t)OmmDataLayout::Indices].resize(indexDataSize);
+            memcpy(instance.outData[(uint32_t)OmmDataLayout::Indices].data(), resDesc->indexBuffer, indexDataSize);
+        }
+        ommCpuDestroyBakeResult(bakeResult);
+    }
+}
+
+inline uint32_t ReadIndex(const uint8_t* data, size_t stride, size_t id) {
+    if (stride == sizeof(uint8_t))
+        return data[id];
+    if (stride == sizeof(uint16_t))
+        return ((const uint16_t*)data)[id];
+    return ((const uint32_t*)data)[id];
+}
+
+inline int32_t ReadOmmIndex(const uint8_t* data, size_t stride, size_t id) { // special indices are negative
+    if (stride == sizeof(int8_t))
+        return ((const int8_t*)data)[id];
+    if (stride == sizeof(int16_t))
+        return ((const int16_t*)data)[id];
+    return ((const int32_t*)data)[id];
+}
+
+inline void ReadTexCoord(const InputBuffer& uvs, size_t id, float outUv[2]) {
+    const uint8_t* data = (const uint8_t*)uvs.nriBufferOrPtr.ptr + id * uvs.stride + uvs.offsetInStruct;
+    if (uvs.format == nri::Format::RG32_SFLOAT)
+        memcpy(outUv, data, sizeof(float) * 2);
+    else {
+        uint16_t encoded[2];
+        memcpy(encoded, data, sizeof(encoded));
+        for (uint32_t axis = 0; axis < 2; ++axis)
+            outUv[axis] = uvs.format == nri::Format::RG16_UNORM ? float(encoded[axis]) / 65535.0f : HalfToFloat(encoded[axis]);
+    }
+}
+
+inline size_t GetOmmArrayDataSize(const ommCpuOpacityMicromapDesc& desc) { // whole bytes per micromap
+    size_t bitsPerState = desc.format == ommFormat_OC1_2_State ? 1 : 2;
+    return ((size_t(1) << (2 * desc.subdivisionLevel)) * bitsPerState + 7) / 8;
+}
+
+void ExtractDeduplicatedBakeResult(const OmmBakeGeometryDesc& merged, const std::vector<uint32_t>& triangles, bool force32bitIndices, OmmBakeGeometryDesc& outInstance) { // compacts the micromaps referenced by the given merged triangles
+    for (std::vector<uint8_t>& data : outInstance.outData)
+        data.clear();
+
+    const std::vector<uint8_t>& mergedIndices = merged.outData[(uint32_t)OmmDataLayout::Indices];
+    if (mergedIndices.empty())
+        return;
+
+    const ommCpuOpacityMicromapDesc* mergedDescs = (const ommCpuOpacityMicromapDesc*)merged.outData[(uint32_t)OmmDataLayout::DescArray].data();
+    const uint8_t* mergedArrayData = merged.outData[(uint32_t)OmmDataLayout::ArrayData].data();
+
+    std::vector<int32_t> indices(triangles.size());
+    std::vector<ommCpuOpacityMicromapDesc> descs;
+    std::vector<uint8_t> arrayData;
+    std::map<int32_t, int32_t> mergedToLocal;
+    std::map<uint32_t, uint32_t> indexUsage; // subdivisionLevel << 16 | format -> count
+    for (size_t i = 0; i < triangles.size(); ++i) {
+        int32_t mergedIndex = ReadOmmIndex(mergedIndices.data(), merged.outOmmIndexStride, triangles[i]);
+        if (mergedIndex < 0) {
+            indices[i] = mergedIndex;
+            continue;
+        }
+
+        auto it = mergedToLocal.insert(std::make_pair(mergedIndex, (int32_t)descs.size()));
+        if (it.second) {
+            ommCpuOpacityMicromapDesc ommDesc = mergedDescs[mergedIndex];
+            const uint8_t* ommData = mergedArrayData + ommDesc.offset;
+            ommDesc.offset = (uint32_t)arrayData.size();
+            arrayData.insert(arrayData.end(), ommData, ommData + GetOmmArrayDataSize(ommDesc));
+            descs.push_back(ommDesc);
+        }
+
+        indices[i] = it.first->second;
+        const ommCpuOpacityMicromapDesc& ommDesc = descs[it.first->second];
+        ++indexUsage[uint32_t(ommDesc.subdivisionLevel) << 16 | uint32_t(ommDesc.format)];
+    }
+
+    if (descs.empty())
+        return;
+
+    std::map<uint32_t, uint32_t> descUsage;
+    for (const ommCpuOpacityMicromapDesc& ommDesc : descs)
+        ++descUsage[uint32_t(ommDesc.subdivisionLevel) << 16 | uint32_t(ommDesc.format)];
+
+    auto WriteHistogram = [](const std::map<uint32_t, uint32_t>& usage, std::vector<uint8_t>& outData) {
+        outData.resize(usage.size() * sizeof(ommCpuOpacityMicromapUsageCount));
+        ommCpuOpacityMicromapUsageCount* counts = (ommCpuOpacityMicromapUsageCount*)outData.data();
+        for (const auto& it : usage)
+            *counts++ = {it.second, uint16_t(it.first >> 16), uint16_t(it.first & 0xFFFF)};
+        return (uint32_t)usage.size();
+    };
+    outInstance.outDescArrayHistogramCount = WriteHistogram(descUsage, outInstance.outData[(uint32_t)OmmDataLayout::DescArrayHistogram]);
+    outInstance.outIndexHistogramCount = WriteHistogram(indexUsage, outInstance.outData[(uint32_t)OmmDataLayout::IndexHistogram]);
+
+    outInstance.outData[(uint32_t)OmmDataLayout::ArrayData] = std::move(arrayData);
+    outInstance.outData[(uint32_t)OmmDataLayout::DescArray].resize(descs.size() * sizeof(ommCpuOpacityMicromapDesc));
+    memcpy(outInstance.outData[(uint32_t)OmmDataLayout::DescArray].data(), descs.data(), descs.size() * sizeof(ommCpuOpacityMicromapDesc));
+
+    bool is16bit = !force32bitIndices && descs.size() <= size_t(std::numeric_limits<int16_t>::max());
+    std::vector<uint8_t>& outIndices = outInstance.outData[(uint32_t)OmmDataLayout::Indices];
+    outInstance.outOmmIndexFormat = is16bit ? nri::Format::R16_UINT : nri::Format::R32_UINT;
+    outInstance.outOmmIndexStride = is16bit ? sizeof(int16_t) : sizeof(int32_t);
+    outIndices.resize(indices.size() * outInstance.outOmmIndexStride);
+    for (size_t i = 0; i < indices.size(); ++i) {
+        if (is16bit)
+            ((int16_t*)outIndices.data())[i] = int16_t(indices[i]);
+        else
+            ((int32_t*)outIndices.data())[i] = indices[i];
+    }
+}
+
+void OmmCpuBaker::BakeDeduplicated(OmmBakeGeometryDesc** queue, const size_t count, const OmmBakeDesc& desc, const OmmCancelToken* cancel) { // geometries sharing a texture are baked as one set of unique uv triangles
+    using GroupKey = std::tuple<CpuTextureKey, uint32_t, OmmFormats, nri::AddressMode, float, OmmAlphaMode>; // merged geometries must share every other bake parameter too
+    std::map<GroupKey, std::vector<OmmBakeGeometryDesc*>> textureGroups;
+    for (size_t i = 0; i < count; ++i) {
+        const InputTexture& inTexture = queue[i]->texture;
+        const MipDesc& firstMip = inTexture.mips[0];
+        CpuTextureKey textureKey = {firstMip.nriTextureOrPtr.ptr, firstMip.width, firstMip.height, inTexture.mipNum, (uint32_t)inTexture.format, queue[i]->alphaCutoff};
+        textureGroups[GroupKey(textureKey, queue[i]->maxSubdivisionLevel, queue[i]->format, inTexture.addressingMode, queue[i]->borderAlpha, queue[i]->alphaMode)].push_back(queue[i]);
+    }
+
+    OmmBakeDesc groupDesc = desc;
+    groupDesc.cpuFlags.enableSceneDeduplication = false;
+    for (auto& group : textureGroups) {
+        if (cancel && cancel->load(std::memory_order_relaxed))
+            return;
+
+        std::vector<OmmBakeGeometryDesc*>& geometries = group.second;
+        if (geometries.size() == 1) {
+            Bake(geometries.data(), 1, groupDesc);
+            continue;
+        }
+
+        std::map<std::array<uint32_t, 6>, uint32_t> uniqueTriangles; // bitwise uvs of the 3 vertices -> merged triangle
+        std::vector<float> mergedUvs;
+        std::vector<std::vector<uint32_t>> geometryTriangles(geometries.size());
+        size_t triangleNum = 0;
+        for (size_t i = 0; i < geometries.size(); ++i) {
+            const OmmBakeGeometryDesc& geometry = *geometries[i];
+            const uint8_t* indexData = (const uint8_t*)geometry.indices.nriBufferOrPtr.ptr;
+            size_t geometryTriangleNum = geometry.indices.numElements / 3;
+            geometryTriangles[i].resize(geometryTriangleNum);
+            triangleNum += geometryTriangleNum;
+
+            for (size_t triangle = 0; triangle < geometryTriangleNum; ++triangle) {
+                std::array<uint32_t, 6> key;
+                for (uint32_t vertex = 0; vertex < 3; ++vertex) {
+                    float uv[2];
+                    ReadTexCoord(geometry.uvs, ReadIndex(indexData, geometry.indices.stride, triangle * 3 + vertex), uv);
+                    memcpy(key.data() + vertex * 2, uv, sizeof(uv));
+                }
+
+                auto it = uniqueTriangles.insert(std::make_pair(key, uint32_t(mergedUvs.size() / 6)));
+                if (it.second)
+                    mergedUvs.insert(mergedUvs.end(), (const float*)key.data(), (const float*)key.data() + 6);
+                geometryTriangles[i][triangle] = it.first->second;
+            }
+        }
+
+        size_t mergedVertexNum = mergedUvs.size() / 2;
+        std::vector<uint32_t> mergedIndices(mergedVertexNum);
+        for (size_t i = 0; i < mergedVertexNum; ++i)
+            mergedIndices[i] = uint32_t(i);
+
+        OmmBakeGeometryDesc merged = {};
+        merged.texture = geometries[0]->texture;
+        merged.alphaCutoff = geometries[0]->alphaCutoff;
+        merged.borderAlpha = geometries[0]->borderAlpha;
+        merged.maxSubdivisionLevel = geometries[0]->maxSubdivisionLevel;
+        merged.format = geometries[0]->format;
+        merged.alphaMode = geometries[0]->alphaMode;
+        merged.indices.nriBufferOrPtr.ptr = mergedIndices.data();
+        merged.indices.numElements = mergedIndices.size();
+        merged.indices.stride = sizeof(uint32_t);
+        merged.indices.format = nri::Format::R32_UINT;
+        merged.uvs.nriBufferOrPtr.ptr = mergedUvs.data();
+        merged.uvs.numElements = mergedVertexNum;
+        merged.uvs.stride = sizeof(float) * 2;
+        merged.uvs.format = nri::Format::RG32_SFLOAT;
+
+        OmmBakeGeometryDesc* mergedQueue = &merged;
+        Bake(&mergedQueue, 1, groupDesc);
+        printf("[OMM] Scene deduplication: %zu geometries, %zu of %zu triangles baked\n", geometries.size(), mergedVertexNum / 3, triangleNum);
+
+        for (size_t i = 0; i < geometries.size(); ++i)
+            ExtractDeduplicatedBakeResult(merged, geometryTriangles[i], desc.cpuFlags.force32bitIndices, *geometries[i]);
+    }
+}
+
+void OmmCpuBaker::ReleaseTextures(const void* alphaData) { // all baker textures created from this alpha data
+    for (auto it = m_Textures.begin(); it != m_Textures.end();) {
+        if (std::get<0>(it->first) == alphaData) {
+            ommCpuDestroyTexture(m_Baker, it->second);
+            it = m_Textures.erase(it);
+        } else
+            ++it;
+    }
+}
+
+void OmmCpuBaker::PostBakeCleanUp() {
+    for (auto& it : m_Textures)
+        ommCpuDestroyTexture(m_Baker, it.second);
+    m_Textures.clear();
+}
+
+#pragma endregion
+
+#pragma region[ Material bake params ]
+
+void LoadMaterialBakeParams(const char* filename, uint32_t materialNum, std::map<uint32_t, OmmMaterialBakeParams>& outParams) {
+    outParams.clear();
+    FILE* file = fopen(filename, "r");
+    if (!file)
+        return;
+
+    char line[1024];
+    uint32_t lineId = 0;
+    while (fgets(line, sizeof(line), file)) {
+        ++lineId;
+        std::istringstream stream(line);
+        std::string keyword;
+        if (!(stream >> keyword) || keyword[0] == '#')
+            continue;
+
+        uint32_t materialIndex = 0;
+        if (keyword != "material" || !(stream >> materialIndex) || materialIndex >= materialNum) {
+            printf("[OMM][WARNING] %s(%u): expected 'material <index>' with a valid material index\n", filename, lineId);
+            continue;
+        }
+
+        OmmMaterialBakeParams params = {};
+        bool isValid = true;
+        std::string name;
+        std::string value;
+        while (isValid && stream >> name >> value) {
+            std::istringstream valueStream(value);
+            if (name == "level")
+                isValid = bool(valueStream >> params.subdivisionLevel) && params.subdivisionLevel > 0;
+            else if (name == "format") {
+                isValid = value == "OC1_2_STATE" || value == "OC1_4_STATE";
+                params.format = value == "OC1_2_STATE" ? OmmFormats::OC1_2_STATE : OmmFormats::OC1_4_STATE;
+                params.overrideFormat = true;
+            } else
+                isValid = false;
+        }
+
+        if (!isValid) {
+            printf("[OMM][WARNING] %s(%u): invalid '%s %s', line skipped\n", filename, lineId, name.c_str(), value.c_str());
+            continue;
+        }
+
+        outParams[materialIndex] = params;
+    }
+    fclose(file);
+    printf("[OMM] Material overrides: %zu from %s\n", outParams.size(), filename);
+}
+
+#pragma endregion
+
+#pragma region[ OMM Caching ]
+
+std::map<std::string, std::map<uint64_t, uint64_t>> OmmCaching::m_FileIndices;
+
+uint64_t OmmCaching::CalculateSateHash(const OmmBakeDesc& bakeDesc) {
+    struct CommonState { // leave only those parameters of OmmBakeDesc that contribute to state uniqueness
+        uint32_t subdivisionLevel;
+        uint32_t mipBias;
+        uint32_t filter;
+        uint32_t format;
+        uint32_t type;
+        float dynamicSubdivisionScale;
+
+        void InitCommon(const OmmBakeDesc& bakeDesc) {
+            subdivisionLevel = bakeDesc.subdivisionLevel;
+            mipBias = bakeDesc.mipBias;
+            dynamicSubdivisionScale = bakeDesc.dynamicSubdivisionScale;
+            filter = (uint32_t)bakeDesc.filter;
+            format = (uint32_t)bakeDesc.format;
+            type = (uint32_t)bakeDesc.type;
+        }
+    };
+
+    struct GpuState : public CommonState {
+        GpuBakerFlags gpuFlags;
+
+        void Init(const OmmBakeDesc& bakeDesc) {
+            InitCommon(bakeDesc);
+            gpuFlags = bakeDesc.gpuFlags;
+        }
+    };
+
+    struct CpuState : public CommonState {
+        CpuBakerFlags cpuFlags;
+        uint32_t mipCount;
+
+        void Init(const OmmBakeDesc& bakeDesc) {
+            InitCommon(bakeDesc);
+            cpuFlags = bakeDesc.cpuFlags;
+            mipCount = bakeDesc.mipCount;
+        }
+    };
+
+    GpuState gpuState = {};
+    CpuState cpuState = {};
+    memset(&gpuState, 0, sizeof(GpuState));
+    memset(&cpuState, 0, sizeof(CpuState));
+    gpuState.Init(bakeDesc);
+    cpuState.Init(bakeDesc);
+
+    const uint8_t* p = (bakeDesc.type == OmmBakerType::GPU) ? (uint8_t*)&gpuState : (uint8_t*)&cpuState;
+    size_t len = (bakeDesc.type == OmmBakerType::GPU) ? sizeof(GpuState) : sizeof(CpuState);
+
+    uint64_t result = 14695981039346656037ull;
+    while (len--)
+        result = (result ^ (*p++)) * 1099511628211ull;
+    return result;
+}
+
+uint64_t OmmCaching::CalculateGeometryHash(uint32_t meshIndex, uint32_t materialIndex, uint64_t meshContentHash, uint64_t textureContentHash, const OmmBakeGeometryDesc& geometryDesc, const OmmBakeDesc& bakeDesc) { // edited meshes and textures get new entries instead of stale masks
+    uint64_t hash = uint64_t(meshIndex) << 32 | uint64_t(materialIndex);
+    if (geometryDesc.maxSubdivisionLevel != bakeDesc.subdivisionLevel)
+        hash = (hash ^ geometryDesc.maxSubdivisionLevel) * 1099511628211ull;
+    if (geometryDesc.format != bakeDesc.format)
+        hash = (hash ^ (uint64_t(geometryDesc.format) << 8)) * 1099511628211ull;
+    return HashMix(hash ^ HashMix(meshContentHash ^ HashMix(textureContentHash)));
+}
+
+inline uint64_t CalculateIdentifier(uint64_t a, uint64_t b) {
+    uint64_t identifier = ((a + b) * (a + b + 1)) / 2 + b;
+    return identifier;
+}
+
+void OmmCaching::PrewarmCache(const char* filename, FILE* file, size_t fileSize) {
+    bool reachedEnd = false;
+    while (reachedEnd != true) {
+        MaskHeader currentHeader = {};
+        size_t currentPos = ftell(file);
+        if (ReadChunkFromFile(filename, file, fileSize, (void*)&currentHeader, sizeof(MaskHeader)) == false)
+            return;
+
+        uint64_t identifier = CalculateIdentifier(currentHeader.stateHash, currentHeader.instanceHash);
+        m_FileIndices[filename].insert(std::make_pair(identifier, uint64_t(currentPos)));
+
+        size_t blobSize = currentHeader.blobSize;
+        currentPos = ftell(file);
+        if (ValidateChunkRead(filename, file, fileSize, currentPos, blobSize) == false) {
+            m_FileIndices.erase(filename);
+            return;
+        }
+
+        fseek(file, long(currentPos + blobSize), SEEK_SET);
+        reachedEnd = ftell(file) == fileSize;
+    }
+    fseek(file, 0, SEEK_SET);
+}
+
+bool OmmCaching::LookForCache(const char* filename, uint64_t stateMask, uint64_t hash, size_t* dataOffset) {
+    if (m_FileIndices[filename].empty()) {
+        FILE* file = fopen(filename, "rb");
+        if (file == nullptr)
+            return false; // file not found
+
+        fseek(file, 0, SEEK_END);
+        size_t fileSize = ftell(file);
+        fseek(file, 0, SEEK_SET);
+
+        PrewarmCache(filename, file, fileSize);
+        fclose(file);
+    }
+
+    const std::map<uint64_t, uint64_t>& index = m_FileIndices[filename];
+    uint64_t identifier = CalculateIdentifier(stateMask, hash);
+    const auto& it = index.find(identifier);
+    if (it == index.end())
+        return false;
+    else {
+        if (dataOffset)
+            *dataOffset = it->second;
+        return true;
+    }
+}
+
+bool OmmCaching::ReadMaskFromCache(const char* filename, OmmData& data, uint64_t stateMask, uint64_t hash, uint16_t* ommIndexFormat) {
+    size_t dataOffset = 0;
+    if (LookForCache(filename, stateMask, hash, &dataOffset) == false)
+        return false;
+
+    FILE* file = fopen(filename, "rb");
+    if (file == nullptr) {
+        printf("[FAIL] Unable to open file for reading: {%s}\n", filename);
+        m_FileIndices.erase(filename);
+        return false;
+    }
+
+    fseek(file, 0, SEEK_END);
+    size_t fileSize = ftell(file);
+    fseek(file, long(dataOffset), SEEK_SET);
+
+    MaskHeader header = {};
+    if (ReadChunkFromFile(filename, file, fileSize, &header, sizeof(header)) == false)
+        return false;
+
+    std::vector<uint8_t> blob(header.blobSize);
+    if (ReadChunkFromFile(filename, file, fileSize, blob.data(), header.blobSize) == false)
+        return false;
+
+    for (uint32_t i = 0; i < (uint32_t)OmmDataLayout::CpuMaxNum; ++i) {
+        void* out = data.data[i];
+        data.sizes[i] = header.sizes[i];
+
+        if (!out)
+            continue;
+
+        memcpy(out, blob.data(), header.sizes[i]);
+        blob.erase(blob.begin(), blob.begin() + header.sizes[i]);
+    }
+
+    if (ommIndexFormat)
+        *ommIndexFormat = header.ommIndexFormat;
+
+    fclose(file);
+    return true;
+}
+
+void OmmCaching::SaveMasksToDisc(const char* filename, const OmmData& data, uint64_t stateMask, uint64_t hash, uint32_t ommIndexFormat) {
+    if (LookForCache(filename, stateMask, hash, nullptr))
+        return; // mask for this state is already cached
+
+    FILE* outputFile = fopen(filename, "ab");
+    if (outputFile == nullptr) {
+        printf("[FAIL] Unable to open file for writing: {%s}\n", filename);
+        m_FileIndices.erase(filename);
+        return;
+    }
+
+    fseek(outputFile, 0, SEEK_END);
+    size_t fileSize = ftell(outputFile);
+    fseek(outputFile, 0, SEEK_SET);
+
+    size_t blobSize = 0;
+    for (uint32_t i = 0; i < (uint32_t)OmmDataLayout::CpuMaxNum; ++i)
+        blobSize += data.sizes[i];
+
+    if (blobSize != 0) {
+        MaskHeader header = {};
+        std::vector<uint8_t> dataBlob;
+        dataBlob.reserve(blobSize);
+
+        for (uint32_t i = 0; i < (uint32_t)OmmDataLayout::CpuMaxNum; ++i) {
+            uint64_t size = data.sizes[i];
+            header.sizes[i] = size;
+            size_t blobOffset = dataBlob.size();
+            dataBlob.resize(dataBlob.size() + size);
+            memcpy(dataBlob.data() + blobOffset, data.data[i], size);
+        }
+
+        header.instanceHash = hash;
+        header.stateHash = stateMask;
+        header.ommIndexFormat = (uint16_t)ommIndexFormat;
+        header.blobSize = blobSize;
+
+        if (!WriteChunkToFile(filename, outputFile, (void*)&header, sizeof(header)))
+            return;
+        if (!WriteChunkToFile(filename, outputFile, (void*)dataBlob.data(), header.blobSize))
+            return;
+
+        uint64_t identifier = CalculateIdentifier(stateMask, hash);
+        m_FileIndices[filename].insert(std::make_pair(identifier, fileSize));
+    }
+
+    fclose(outputFile);
+}
+
+size_t OmmCaching::MergeCacheFiles(const char* filename, const std::vector<std::string>& inputFilenames) {
+    std::vector<std::string> sources;
+    if (std::filesystem::exists(filename))
+        sources.push_back(filename); // existing entries stay first
+    sources.insert(sources.end(), inputFilenames.begin(), inputFilenames.end());
+
+    std::string tmpFilename = std::string(filename) + ".tmp"; // written aside and renamed, readers never see a partial merge
+    FILE* outputFile = fopen(tmpFilename.c_str(), "wb");
+    if (outputFile == nullptr) {
+        printf("[FAIL] Unable to open file for writing: {%s}\n", tmpFilename.c_str());
+        return 0;
+    }
+
+    std::set<std::pair<uint64_t, uint64_t>> keys; // state hash, instance hash
+    std::vector<uint8_t> blob;
+    size_t entryNum = 0;
+    bool success = true;
+    for (size_t i = 0; i < sources.size() && success; ++i) {
+        const char* source = sources[i].c_str();
+        FILE* file = fopen(source, "rb");
+        if (file == nullptr) {
+            printf("[FAIL] Unable to open file for reading: {%s}\n", source);
+            success = false;
+            break;
+        }
+
+        fseek(file, 0, SEEK_END);
+        size_t fileSize = ftell(file);
+        fseek(file, 0, SEEK_SET);
+
+        size_t currentPos = 0;
+        while (currentPos < fileSize) {
+            MaskHeader header = {};
+            if (currentPos + sizeof(header) > fileSize || fread(&header, 1, sizeof(header), file) != sizeof(header) || currentPos + sizeof(header) + header.blobSize > fileSize) {
+                printf("[WARNING] File end unexpected, the rest is skipped: {%s}\n", source); // a shard job died while writing
+                break;
+            }
+            currentPos += sizeof(header) + header.blobSize;
+
+            if (!keys.insert(std::make_pair(header.stateHash, header.instanceHash)).second) {
+                fseek(file, long(currentPos), SEEK_SET);
+                continue;
+            }
+
+            blob.resize(header.blobSize);
+            success = fread(blob.data(), 1, blob.size(), file) == blob.size();
+            success = success && fwrite(&header, 1, sizeof(header), outputFile) == sizeof(header);
+            success = success && fwrite(blob.data(), 1, blob.size(), outputFile) == blob.size();
+            if (!success)
+                break;
+            ++entryNum;
+        }
+        fclose(file);
+    }
+    fclose(outputFile);
+
+    std::error_code error;
+    if (success)
+        std::filesystem::rename(tmpFilename, filename, error);
+    if (!success || error) {
+        printf("[FAIL] Unable to merge into: {%s}\n", filename);
+        std::filesystem::remove(tmpFilename, error);
+        return 0;
+    }
+
+    m_FileIndices.erase(filename);
+    return entryNum;
+}
+
+void OmmCaching::CreateFolder(const char* path) {
+    bool success = true;
+    if (std::filesystem::exists(path) == false)
+        success = std::filesystem::create_directory(path);
+    if (!success)
+        printf("[FAIL] Unable to create folder: {%s}\n", path);
+};
+
+inline bool OmmCaching::WriteChunkToFile(const char* fileName, FILE* file, void* data, size_t size) {
+    if (fwrite(data, 1, size, file) != size) {
+        printf("[FAIL] Unable to write to file: {%s}\n", fileName);
+        fclose(file);
+        std::filesystem::remove(fileName);
+        m_FileIndices.erase(fileName);
+        return false;
+    }
+    return true;
+}
+
+inline bool OmmCaching::ValidateChunkRead(const char* fileName, FILE* file, size_t fileSize, size_t currentPos, size_t dataSize) {
+    if (currentPos + dataSize > fileSize) {
+        printf("[FAIL] File end unexpected. Invalidating: {%s}\n", fileName);
+        fclose(file);
+        std::filesystem::remove(fileName);
+        m_FileIndices.erase(fileName);
+        return false;
+    }
+    return true;
+}
+
+inline bool OmmCaching::ReadChunkFromFile(const char* fileName, FILE* file, size_t fileSize, void* data, size_t dataSize) {
+    size_t currentPos = ftell(file);
+    if (ValidateChunkRead(fileName, file, fileSize, currentPos, dataSize) == false)
+        return false;
+
+    if (fread(data, 1, dataSize, file) != dataSize) {
+        printf("[FAIL] Unable to read file: {%s}\n", fileName);
+        fclose(file);
+        m_FileIndices.erase(fileName);
+        return false;
+    }
+    return true;
+}
+
+std::vector<AlphaMipCache::Mapping> AlphaMipCache::m_Mappings;
+
+constexpr uint64_t ALPHA_MIP_CACHE_MAGIC = 0x3250494D48504C41ull; // "ALPHMIP2"
+
+inline bool operator==(const AlphaMipCache::SourceDesc& a, const AlphaMipCache::SourceDesc& b) {
+    return a.size == b.size && a.format == b.format && a.width == b.width && a.height == b.height;
+}
+
+uint64_t AlphaMipCache::CalculateContentHash(const uint8_t* data, const SourceDesc& source) { // the only key of a cached mip, so every input bit must affect every output bit
+    uint64_t seed = HashMix(source.size ^ HashMix(uint64_t(source.format) << 32 ^ HashMix(uint64_t(source.width) << 32 | uint64_t(source.height))));
+    return HashBytes(data, source.size, seed);
+}
+
+std::string AlphaMipCache::GetFilename(const char* folder, uint64_t contentHash) {
+    char name[32];
+    snprintf(name, sizeof(name), "%016llx.r8", (unsigned long long)contentHash);
+    return std::string(folder) + "/" + name;
+}
+
+const uint8_t* AlphaMipCache::MapAlphaMip(const char* folder, uint64_t contentHash, const SourceDesc& source, size_t dataSize) {
+    std::string filename = GetFilename(folder, contentHash);
+    size_t fileSize = sizeof(Header) + dataSize;
+    void* view = nullptr;
+#ifdef _WIN32
+    HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return nullptr; // not cached yet
+
+    LARGE_INTEGER size = {};
+    if (GetFileSizeEx(file, &size) && size_t(size.QuadPart) == fileSize) {
+        HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+        if (mapping) {
+            view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+            CloseHandle(mapping); // the view keeps the mapping alive
+        }
+    }
+    CloseHandle(file);
+#else
+    int file = open(filename.c_str(), O_RDONLY);
+    if (file == -1)
+        return nullptr; // not cached yet
+
+    struct stat info = {};
+    if (fstat(file, &info) == 0 && size_t(info.st_size) == fileSize) {
+        view = mmap(nullptr, fileSize, PROT_READ, MAP_PRIVATE, file, 0);
+        if (view == MAP_FAILED)
+            view = nullptr;
+    }
+    close(file);
+#endif
+
+    if (!view) {
+        printf("[FAIL] Unable to map alpha cache: {%s}\n", filename.c_str());
+        return nullptr;
+    }
+    const Header* header = (const Header*)view;
+    if (header->magic != ALPHA_MIP_CACHE_MAGIC || header->contentHash != contentHash || header->dataSize != dataSize) {
+        printf("[FAIL] Alpha cache is corrupted. Invalidating: {%s}\n", filename.c_str());
+        Unmap({view, fileSize}); // release the view before the mip is rewritten
+        return nullptr;
+    }
+    if (!(header->source == source)) {
+        printf("[WARNING] Alpha cache hash collision, decoding again: {%s}\n", filename.c_str());
+        Unmap({view, fileSize});
+        return nullptr;
+    }
+
+    m_Mappings.push_back({view, fileSize});
+    return (const uint8_t*)view + sizeof(Header);
+}
+
+void AlphaMipCache::SaveAlphaMip(const char* folder, uint64_t contentHash, const SourceDesc& source, const uint8_t* data, size_t dataSize) {
+    std::string filename = GetFilename(folder, contentHash);
+    std::string tmpFilename = filename + ".tmp"; // written aside and renamed so a partially written mip is never mapped
+
+    FILE* file = fopen(tmpFilename.c_str(), "wb");
+    if (file == nullptr) {
+        printf("[FAIL] Unable to open file for writing: {%s}\n", tmpFilename.c_str());
+        return;
+    }
+
+    Header header;
+    memset(&header, 0, sizeof(header)); // no uninitialized padding on disk
+    header.magic = ALPHA_MIP_CACHE_MAGIC;
+    header.contentHash = contentHash;
+    header.dataSize = dataSize;
+    header.source = source;
+    bool success = fwrite(&header, 1, sizeof(header), file) == sizeof(header);
+    success = success && fwrite(data, 1, dataSize, file) == dataSize;
+    fclose(file);
+
+    std::error_code error;
+    if (success)
+        std::filesystem::rename(tmpFilename, filename, error);
+    if (!success || error) {
+        printf("[FAIL] Unable to write to file: {%s}\n", filename.c_str());
+        std::filesystem::remove(tmpFilename, error);
+    }
+}
+
+void AlphaMipCache::Unmap(const Mapping& mapping) {
+#ifdef _WIN32
+    UnmapViewOfFile(mapping.view);
+#else
+    munmap(mapping.view, mapping.size);
+#endif
+}
+
+void AlphaMipCache::UnmapAll() {
+    for (const Mapping& mapping : m_Mappings)
+        Unmap(mapping);
+    m_Mappings.clear();
+}
+
+#pragma endregion
+} // namespace ommhelper
@@ -0,0 +1,322 @@
+/*
+Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+
+NVIDIA CORPORATION and its licensors retain all intellectual property
+and proprietary rights in and to this software, related documentation
+and any modifications thereto. Any use, reproduction, disclosure or
+distribution of this software and related documentation without an express
+license agreement from NVIDIA CORPORATION is strictly prohibited.
+*/
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstring>
+#include <map>
+#include <string>
+#include <tuple>
+#include <vector>
+
+#include "NRI.h"
+
+#define OMM_SUPPORTS_CPP17 (1)
+#include "omm.h"
+
+namespace ommhelper {
+enum class OmmFormats {
+    OC1_2_STATE,
+    OC1_4_STATE,
+    Count
+};
+
+enum class OmmBakeFilter {
+    Nearest = (uint32_t)ommTextureFilterMode_Nearest,
+    Linear = (uint32_t)ommTextureFilterMode_Linear,
+    Count,
+};
+
+enum class OmmBakerType {
+    GPU,
+    CPU,
+    Count
+};
+
+struct CpuBakerFlags {
+    bool enableInternalThreads = true;
+    bool enableSpecialIndices = true;
+    bool enableDuplicateDetection = true;
+    bool enableNearDuplicateDetection = false;
+    bool force32bitIndices = false;
+#if DXR_OMM
+    bool allow8bitIndices = true;
+#else
+    bool allow8bitIndices = false;
+#endif
+    bool enableSceneDeduplication = false; // across all geometries of a bake call sharing a texture
+};
+
+struct GpuBakerFlags {
+    bool enablePostBuildInfo = true;
+    bool enableSpecialIndices = true;
+    bool enableTexCoordDeduplication = true;
+    bool force32bitIndices = false;
+    bool computeOnlyWorkload = true;
+#if DXR_OMM
+    bool allow8bitIndices = true;
+#else
+    bool allow8bitIndices = false;
+#endif
+};
+
+struct OmmBakeDesc {
+    uint32_t subdivisionLevel = 9; // 4^N
+    uint32_t mipBias = 0;
+    uint32_t mipCount = 1;
+    uint32_t buildFrameId = 0;
+    float dynamicSubdivisionScale = 1.0f;
+    OmmBakeFilter filter = OmmBakeFilter::Linear;
+    OmmFormats format = OmmFormats::OC1_4_STATE;
+    OmmBakerType type = OmmBakerType::GPU;
+    CpuBakerFlags cpuFlags;
+    GpuBakerFlags gpuFlags;
+    bool enableDebugMode = false;
+    bool enableCache = false;
+    bool enableAutoSubdivisionLevel = false; // per geometry level from texel density, up to subdivisionLevel
+    uint32_t memoryBudgetMb = 0;             // 0 - unlimited. Otherwise per geometry levels and formats are lowered to fit the predicted output into it
+    uint32_t alphaDecodeBudgetMb = 0;        // cpu baker only. 0 - unlimited. Otherwise decoded alpha is streamed per batch within it, output is not affected
+};
+
+enum class OmmGpuBakerPass {
+    Setup = ommGpuBakeFlags_PerformSetup,
+    Bake = ommGpuBakeFlags_PerformBake,
+    Combined = Setup | Bake,
+};
+
+enum class OmmAlphaMode {
+    Test = (uint32_t)ommAlphaMode_Test,
+    Blend = (uint32_t)ommAlphaMode_Blend,
+    MaxNum = (uint32_t)ommAlphaMode_MAX_NUM,
+};
+
+enum class OmmDataLayout {
+    ArrayData,
+    DescArray,
+    Indices,
+    DescArrayHistogram,
+    IndexHistogram,
+    GpuPostBuildInfo,
+    MaxNum,
+    BlasBuildGpuBuffersNum = DescArrayHistogram,
+    CpuMaxNum = GpuPostBuildInfo,
+    GpuOutputNum = MaxNum,
+};
+
+struct GpuBakerBuffer {
+    nri::Buffer* buffer;
+    uint64_t bufferSize; // total buffer size
+    uint64_t dataSize;
+    uint64_t offset;
+};
+
+struct InputBuffer {
+    union NriBufferOrPtr {
+        nri::Buffer* buffer;
+        void* ptr;
+    } nriBufferOrPtr;
+
+    uint64_t bufferSize; // total buffer size;
+    uint64_t offset;
+    uint64_t numElements;
+    uint64_t stride;
+    uint64_t offsetInStruct;
+    nri::Format format;
+};
+
+inline uint16_t FloatToHalf(float value) { // round to nearest even
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    uint32_t sign = (bits >> 16) & 0x8000;
+    uint32_t magnitude = bits & 0x7FFFFFFF;
+    if (magnitude >= 0x7F800000) // inf, nan
+        return uint16_t(sign | 0x7C00 | (magnitude > 0x7F800000 ? 0x200 : 0));
+    if (magnitude >= 0x477FF000) // overflow
+        return uint16_t(sign | 0x7C00);
+    if (magnitude < 0x38800000) { // denormal
+        uint32_t mantissa = (magnitude & 0x7FFFFF) | 0x800000;
+        uint32_t shift = 126 - (magnitude >> 23);
+        if (shift > 24)
+            return uint16_t(sign);
+        uint32_t half = mantissa >> shift;
+        uint32_t remainder = mantissa & ((1u << shift) - 1);
+        uint32_t halfway = 1u << (shift - 1);
+        half += remainder > halfway || (remainder == halfway && (half & 1));
+        return uint16_t(sign | half);
+    }
+    uint32_t half = (magnitude - 0x38000000) >> 13;
+    uint32_t remainder = magnitude & 0x1FFF;
+    half += remainder > 0x1000 || (remainder == 0x1000 && (half & 1));
+    return uint16_t(sign | half);
+}
+
+inline float HalfToFloat(uint16_t value) {
+    uint32_t sign = uint32_t(value & 0x8000) << 16;
+    uint32_t exponent = (value >> 10) & 0x1F;
+    uint32_t mantissa = value & 0x3FF;
+    float result;
+    if (exponent == 0)
+        result = float(mantissa) * (1.0f / 16777216.0f); // 2^-24
+    else if (exponent == 31) {
+        uint32_t bits = 0x7F800000 | (mantissa << 13);
+        memcpy(&result, &bits, sizeof(result));
+    } else {
+        uint32_t bits = ((exponent + 112) << 23) | (mantissa << 13);
+        memcpy(&result, &bits, sizeof(result));
+    }
+    uint32_t bits;
+    memcpy(&bits, &result, sizeof(bits));
+    bits |= sign;
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+}
+
+#define OMM_MAX_MIP_NUM 16
+
+struct MipDesc {
+    union NriTextureOrPtr {
+        nri::Texture* texture;
+        void* ptr;
+    } nriTextureOrPtr;
+
+    uint32_t width;
+    uint32_t height;
+    uint32_t rowPitch;
+};
+
+struct InputTexture {
+    MipDesc mips[OMM_MAX_MIP_NUM];
+
+    uint32_t mipOffset;
+    uint32_t mipNum;
+
+    uint32_t alphaChannelId;
+    nri::Format format;
+    nri::AddressMode addressingMode;
+};
+
+struct OmmBakeGeometryDesc {
+    InputBuffer indices;
+    InputBuffer uvs;
+    InputTexture texture;
+
+    GpuBakerBuffer gpuBuffers[uint32_t(OmmDataLayout::GpuOutputNum)];
+    GpuBakerBuffer transientBuffers[OMM_MAX_TRANSIENT_POOL_BUFFERS];
+    GpuBakerBuffer readBackBuffers[uint32_t(OmmDataLayout::GpuOutputNum)];
+
+    std::vector<uint8_t> outData[uint32_t(OmmDataLayout::MaxNum)]; // cpu baker outputs/gpu baker readback for caching
+
+    struct GpuBakerPrebuildInfo {
+        uint64_t dataSizes[(uint32_t)OmmDataLayout::GpuOutputNum];
+        uint64_t transientBufferSizes[OMM_MAX_TRANSIENT_POOL_BUFFERS];
+    } gpuBakerPreBuildInfo;
+
+    float alphaCutoff;
+    float borderAlpha;
+    uint32_t maxSubdivisionLevel; // per geometry, never above OmmBakeDesc::subdivisionLevel
+    OmmFormats format;            // per geometry, OC1_2_STATE may replace OmmBakeDesc::format under a memory budget
+
+    uint32_t outIndexHistogramCount;
+    uint32_t outDescArrayHistogramCount;
+    uint32_t outOmmIndexStride;
+    nri::Format outOmmIndexFormat;
+    OmmAlphaMode alphaMode;
+};
+
+struct OmmMaterialBakeParams { // overridden per material by the scene sidecar, see LoadMaterialBakeParams(). Alpha test params are fixed by the any-hit shader
+    uint32_t subdivisionLevel = 0; // 0 - global or auto level, otherwise up to the global level
+    OmmFormats format = OmmFormats::OC1_4_STATE;
+    bool overrideFormat = false;
+};
+
+// "<scene>.omm" next to the scene file, one line per material: material <index> [level <n>] [format OC1_2_STATE|OC1_4_STATE]
+void LoadMaterialBakeParams(const char* filename, uint32_t materialNum, std::map<uint32_t, OmmMaterialBakeParams>& outParams);
+
+struct OmmCaching {
+    struct MaskHeader {
+        uint64_t instanceHash;
+        uint64_t stateHash;
+        uint64_t sizes[(uint32_t)OmmDataLayout::CpuMaxNum];
+        uint64_t blobSize;
+        uint16_t ommIndexFormat;
+    };
+
+    struct OmmData {
+        void* data[(uint32_t)OmmDataLayout::CpuMaxNum];
+        uint64_t sizes[(uint32_t)OmmDataLayout::CpuMaxNum];
+    };
+
+    static uint64_t CalculateSateHash(const OmmBakeDesc& buildDesc);
+    static uint64_t CalculateGeometryHash(uint32_t meshIndex, uint32_t materialIndex, uint64_t meshContentHash, uint64_t textureContentHash, const OmmBakeGeometryDesc& geometryDesc, const OmmBakeDesc& bakeDesc); // instance hash of a geometry in the cache file
+    static bool LookForCache(const char* filename, uint64_t stateMask, uint64_t hash, size_t* dataOffset = nullptr);
+    static bool ReadMaskFromCache(const char* filename, OmmData& data, uint64_t stateMask, uint64_t hash, uint16_t* ommIndexFormat);
+    static void SaveMasksToDisc(const char* filename, const OmmData& data, uint64_t stateMask, uint64_t hash, uint32_t ommIndexFormat);
+    static size_t MergeCacheFiles(const char* filename, const std::vector<std::string>& inputFilenames); // appends unique entries of the inputs to the file. Returns the entry count after the merge, 0 on failure
+    static void CreateFolder(const char* path);
+
+private:
+    static void PrewarmCache(const char* filename, FILE* file, size_t fileSize);
+    static bool WriteChunkToFile(const char* fileName, FILE* file, void* data, size_t size);
+    static bool ValidateChunkRead(const char* fileName, FILE* file, size_t fileSize, size_t currentPos, size_t dataSize);
+    static bool ReadChunkFromFile(const char* fileName, FILE* file, size_t fileSize, void* data, size_t dataSize);
+    static std::map<std::string, std::map<uint64_t, uint64_t>> m_FileIndices; // filename -> identifier -> header offset
+};
+
+struct AlphaMipCache { // decoded R8 alpha mips for the cpu baker. One file per mip, keyed by the hash of the source texture data
+    struct SourceDesc { // source mip the alpha is decoded from, stored next to the content hash and compared on load
+        uint64_t size; // payload size, compressed for block formats
+        uint32_t format;
+        uint32_t width;
+        uint32_t height;
+    };
+
+    struct Header {
+        uint64_t magic;
+        uint64_t contentHash;
+        uint64_t dataSize;
+        SourceDesc source;
+    };
+
+    static uint64_t CalculateContentHash(const uint8_t* data, const SourceDesc& source);
+    static const uint8_t* MapAlphaMip(const char* folder, uint64_t contentHash, const SourceDesc& source, size_t dataSize); // returns nullptr on cache miss. Valid until UnmapAll()
+    static void SaveAlphaMip(const char* folder, uint64_t contentHash, const SourceDesc& source, const uint8_t* data, size_t dataSize);
+    static void UnmapAll();
+
+private:
+    struct Mapping {
+        void* view;
+        size_t size;
+    };
+
+    static std::string GetFilename(const char* folder, uint64_t contentHash);
+    static void Unmap(const Mapping& mapping);
+    static std::vector<Mapping> m_Mappings;
+};
+
+using OmmCancelToken = std::atomic<bool>; // set from any thread, a running bake stops at the next geometry boundary
+
+class OmmCpuBaker { // needs no device, usable without a graphics API
+public:
+    void Initialize();
+    void Bake(OmmBakeGeometryDesc** queue, const size_t count, const OmmBakeDesc& desc, const OmmCancelToken* cancel = nullptr); // geometries skipped on cancel keep empty outputs
+    void ReleaseTextures(const void* alphaData);
+    void PostBakeCleanUp();
+    void Destroy();
+
+private:
+    void BakeDeduplicated(OmmBakeGeometryDesc** queue, const size_t count, const OmmBakeDesc& desc, const OmmCancelToken* cancel);
+
+    ommBaker m_Baker = 0;
+    using CpuTextureKey = std::tuple<const void*, uint32_t, uint32_t, uint32_t, uint32_t, float>; // first mip data, width, height, mipNum, format, alphaCutoff
+    std::map<CpuTextureKey, ommCpuTexture> m_Textures;                                            // shared by all geometries referencing the same alpha data until PostBakeCleanUp()
+};
+} // namespace ommhelper
@@ -0,0 +1,336 @@
+/*
+Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+
+NVIDIA CORPORATION and its licensors retain all intellectual property
+and proprietary rights in and to this software, related documentation
+and any modifications thereto. Any use, reproduction, disclosure or
+distribution of this software and related documentation without an express
+license agreement from NVIDIA CORPORATION is strictly prohibited.
+*/
+
+#include "OmmBakeInputs.h"
+#include "OmmBakerIntegration.h" // HashBytes
+#include <algorithm>
+#include <limits>
+#include <set>
+
+#if defined(__SSSE3__) || (defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86)))
+#    include <tmmintrin.h> // _mm_shuffle_epi8
+#    define OMM_BAKE_INPUTS_SSSE3 1
+#else
+#    define OMM_BAKE_INPUTS_SSSE3 0
+#endif
+
+namespace ommhelper {
+#pragma region[ Geometry ]
+
+std::vector<uint32_t> FilterOutAlphaTestedGeometry(const utils::Scene& scene) { // Filter out alphaOpaque geometry by mesh and material IDs
+    std::vector<uint32_t> result;
+    std::set<uint64_t> processedCombinations;
+    for (uint32_t instaceId = 0; instaceId < (uint32_t)scene.instances.size(); ++instaceId) {
+        const utils::Instance& instance = scene.instances[instaceId];
+        const utils::Material& material = scene.materials[instance.materialIndex];
+        if (material.IsAlphaOpaque()) {
+            uint64_t mask = uint64_t(instance.meshInstanceIndex) << 32 | uint64_t(instance.materialIndex);
+            size_t currentCount = processedCombinations.size();
+            processedCombinations.insert(mask);
+            bool isDuplicate = processedCombinations.size() == currentCount;
+            if (isDuplicate == false)
+                result.push_back(instaceId);
+        }
+    }
+    return result;
+}
+
+uint32_t GetTexelDensitySubdivisionLevel(const utils::Scene& scene, uint32_t meshIndex, uint32_t materialIndex, const OmmBakeDesc& bakeDesc) { // finest level at which micro-triangles of the largest triangle still cover a texel
+    float maxTexelArea = 0.0f;
+    ForEachUvTriangleTexelArea(scene, meshIndex, materialIndex, bakeDesc.mipBias, [&maxTexelArea](float texelArea) { maxTexelArea = std::max(maxTexelArea, texelArea); });
+
+    float level = std::floor(0.5f * std::log2(std::max(maxTexelArea, 1.0f)));
+    return std::max(std::min((uint32_t)level, bakeDesc.subdivisionLevel), 1u);
+}
+
+void SetRuntimeAlphaParams(OmmBakeGeometryDesc& outDesc) {
+    outDesc.texture.addressingMode = nri::AddressMode::REPEAT;
+    outDesc.texture.alphaChannelId = 3;
+    outDesc.alphaCutoff = 0.5f;
+    outDesc.borderAlpha = 0.0f;
+    outDesc.alphaMode = OmmAlphaMode::Test;
+}
+
+void ResolveGeometryBakeParams(const utils::Scene& scene, uint32_t meshIndex, uint32_t materialIndex, const OmmMaterialBakeParams& params, const OmmBakeDesc& bakeDesc, OmmBakeGeometryDesc& outDesc) { // memory budget is applied on top by the caller
+    SetRuntimeAlphaParams(outDesc);
+    outDesc.maxSubdivisionLevel = bakeDesc.enableAutoSubdivisionLevel ? GetTexelDensitySubdivisionLevel(scene, meshIndex, materialIndex, bakeDesc) : bakeDesc.subdivisionLevel;
+    outDesc.maxSubdivisionLevel = params.subdivisionLevel ? std::min(params.subdivisionLevel, bakeDesc.subdivisionLevel) : outDesc.maxSubdivisionLevel;
+    outDesc.format = params.overrideFormat ? params.format : bakeDesc.format;
+}
+
+void GetAlphaMipRange(const utils::Texture* texture, const OmmBakeDesc& bakeDesc, uint32_t& outMipOffset, uint32_t& outMipNum) {
+    uint32_t minMip = texture->GetMipNum() - 1;
+    outMipOffset = bakeDesc.mipBias > minMip ? minMip : bakeDesc.mipBias;
+    uint32_t remainingMips = minMip - outMipOffset + 1;
+    outMipNum = std::min(bakeDesc.mipCount > remainingMips ? remainingMips : bakeDesc.mipCount, (uint32_t)OMM_MAX_MIP_NUM);
+}
+
+void GetMeshUvRange(const utils::Scene& scene, const utils::Mesh& mesh, float outUvMin[2], float outUvMax[2]) {
+    for (uint32_t axis = 0; axis < 2; ++axis) {
+        outUvMin[axis] = std::numeric_limits<float>::max();
+        outUvMax[axis] = -std::numeric_limits<float>::max();
+    }
+
+    for (uint32_t y = 0; y < mesh.vertexNum; ++y) {
+        const float* uv = scene.unpackedVertices[mesh.vertexOffset + y].uv;
+        for (uint32_t axis = 0; axis < 2; ++axis) {
+            outUvMin[axis] = std::min(outUvMin[axis], uv[axis]);
+            outUvMax[axis] = std::max(outUvMax[axis], uv[axis]);
+        }
+    }
+}
+
+nri::Format EncodeOmmUvs(const std::vector<float>& uvs, const uint32_t texelNum[2], std::vector<uint8_t>& outUvData) {
+    bool isUnormValid = true;
+    bool isHalfValid = true;
+    for (size_t i = 0; i < uvs.size(); ++i) {
+        float uv = uvs[i];
+        float maxError = OMM_UV_MAX_TEXEL_ERROR / float(std::max(texelNum[i & 1], 1u));
+        isUnormValid = isUnormValid && uv >= 0.0f && uv <= 1.0f && std::abs(float(uint16_t(uv * 65535.0f + 0.5f)) / 65535.0f - uv) <= maxError;
+        isHalfValid = isHalfValid && std::abs(HalfToFloat(FloatToHalf(uv)) - uv) <= maxError;
+    }
+
+    if (!isUnormValid && !isHalfValid) {
+        outUvData.resize(uvs.size() * sizeof(float));
+        memcpy(outUvData.data(), uvs.data(), outUvData.size());
+        return nri::Format::RG32_SFLOAT;
+    }
+
+    outUvData.resize(uvs.size() * sizeof(uint16_t));
+    uint16_t* encoded = (uint16_t*)outUvData.data();
+    for (size_t i = 0; i < uvs.size(); ++i)
+        encoded[i] = isUnormValid ? uint16_t(uvs[i] * 65535.0f + 0.5f) : FloatToHalf(uvs[i]);
+    return isUnormValid ? nri::Format::RG16_UNORM : nri::Format::RG16_SFLOAT;
+}
+
+nri::Format EncodeOmmMeshUvs(const utils::Scene& scene, const utils::Mesh& mesh, const utils::Texture* texture, std::vector<uint8_t>& outUvData) {
+    const detexTexture* finestMip = (const detexTexture*)texture->mips[0];
+    const uint32_t texelNum[] = {finestMip->width, finestMip->height};
+    std::vector<float> uvs(size_t(mesh.vertexNum) * 2);
+    for (uint32_t y = 0; y < mesh.vertexNum; ++y)
+        memcpy(uvs.data() + size_t(y) * 2, scene.unpackedVertices[mesh.vertexOffset + y].uv, sizeof(float) * 2);
+    return EncodeOmmUvs(uvs, texelNum, outUvData);
+}
+
+nri::Format EncodeOmmIndices(const utils::Index* indices, size_t indexNum, std::vector<uint8_t>& outIndexData) {
+    utils::Index maxIndex = 0;
+    for (size_t i = 0; i < indexNum; ++i)
+        maxIndex = std::max(maxIndex, indices[i]);
+
+    if (maxIndex > std::numeric_limits<uint16_t>::max()) {
+        outIndexData.resize(indexNum * sizeof(uint32_t));
+        for (size_t i = 0; i < indexNum; ++i)
+            ((uint32_t*)outIndexData.data())[i] = uint32_t(indices[i]);
+        return nri::Format::R32_UINT;
+    }
+
+    outIndexData.resize(indexNum * sizeof(uint16_t));
+    for (size_t i = 0; i < indexNum; ++i)
+        ((uint16_t*)outIndexData.data())[i] = uint16_t(indices[i]);
+    return nri::Format::R16_UINT;
+}
+
+#pragma endregion
+
+#pragma region[ Alpha ]
+
+static void ExtractAlpha8(const uint8_t* pixels, uint8_t* outAlpha, size_t pixelBegin, size_t pixelEnd) { // RGBA8: alpha is byte 3 of every pixel
+    size_t i = pixelBegin;
+#if OMM_BAKE_INPUTS_SSSE3
+    const __m128i alphaMask = _mm_setr_epi8(3, 7, 11, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    for (; i + 16 <= pixelEnd; i += 16) {
+        const __m128i* src = (const __m128i*)(pixels + i * 4);
+        __m128i a0 = _mm_shuffle_epi8(_mm_loadu_si128(src + 0), alphaMask);
+        __m128i a1 = _mm_shuffle_epi8(_mm_loadu_si128(src + 1), alphaMask);
+        __m128i a2 = _mm_shuffle_epi8(_mm_loadu_si128(src + 2), alphaMask);
+        __m128i a3 = _mm_shuffle_epi8(_mm_loadu_si128(src + 3), alphaMask);
+        __m128i alpha = _mm_unpacklo_epi64(_mm_unpacklo_epi32(a0, a1), _mm_unpacklo_epi32(a2, a3));
+        _mm_storeu_si128((__m128i*)(outAlpha + i), alpha);
+    }
+#endif
+    for (; i < pixelEnd; ++i) {
+        uint32_t pixel;
+        memcpy(&pixel, pixels + i * 4, sizeof(pixel));
+        outAlpha[i] = uint8_t(detexPixel32GetA8(pixel));
+    }
+}
+
+static void ExtractAlpha16(const uint8_t* pixels, uint8_t* outAlpha, size_t pixelBegin, size_t pixelEnd) { // RGBA16: alpha is the high byte of the last channel
+    size_t i = pixelBegin;
+#if OMM_BAKE_INPUTS_SSSE3
+    const __m128i alphaMask = _mm_setr_epi8(7, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1);
+    for (; i + 16 <= pixelEnd; i += 16) {
+        const __m128i* src = (const __m128i*)(pixels + i * 8);
+        __m128i a[8];
+        for (uint32_t j = 0; j < 8; ++j)
+            a[j] = _mm_shuffle_epi8(_mm_loadu_si128(src + j), alphaMask);
+        __m128i a0123 = _mm_unpacklo_epi32(_mm_unpacklo_epi16(a[0], a[1]), _mm_unpacklo_epi16(a[2], a[3]));
+        __m128i a4567 = _mm_unpacklo_epi32(_mm_unpacklo_epi16(a[4], a[5]), _mm_unpacklo_epi16(a[6], a[7]));
+        _mm_storeu_si128((__m128i*)(outAlpha + i), _mm_unpacklo_epi64(a0123, a4567));
+    }
+#endif
+    for (; i < pixelEnd; ++i) {
+        uint64_t pixel;
+        memcpy(&pixel, pixels + i * 8, sizeof(pixel));
+        outAlpha[i] = uint8_t(detexPixel64GetA16(pixel) >> 8);
+    }
+}
+
+static inline int32_t WrapTexel(int32_t coord, int32_t size) {
+    int32_t result = coord % size;
+    return result < 0 ? result + size : result;
+}
+
+AlphaMipCache::SourceDesc GetAlphaMipSourceDesc(const detexTexture* mip) {
+    AlphaMipCache::SourceDesc desc = {};
+    desc.size = detexFormatIsCompressed(mip->format)
+        ? uint64_t(mip->width_in_blocks) * uint64_t(mip->height_in_blocks) * detexGetCompressedBlockSize(mip->format)
+        : uint64_t(mip->width) * uint64_t(mip->height) * detexGetPixelSize(mip->format);
+    desc.format = mip->format;
+    desc.width = uint32_t(mip->width);
+    desc.height = uint32_t(mip->height);
+    return desc;
+}
+
+uint64_t CalculateAlphaMipContentHash(const detexTexture* mip) {
+    return AlphaMipCache::CalculateContentHash(mip->data, GetAlphaMipSourceDesc(mip));
+}
+
+uint64_t CalculateAlphaTextureContentHash(const uint64_t* mipContentHashes, uint32_t mipNum) {
+    uint64_t hash = HashMix(mipNum);
+    for (uint32_t mip = 0; mip < mipNum; ++mip)
+        hash = HashMix(hash ^ mipContentHashes[mip]);
+    return hash;
+}
+
+uint64_t CalculateMeshContentHash(const utils::Scene& scene, const utils::Mesh& mesh) {
+    uint64_t hash = HashBytes(scene.indices.data() + mesh.indexOffset, size_t(mesh.indexNum) * sizeof(utils::Index), HashMix(mesh.vertexNum));
+    for (uint32_t i = 0; i < mesh.vertexNum; ++i) {
+        const utils::UnpackedVertex& vertex = scene.unpackedVertices[mesh.vertexOffset + i];
+        hash = HashBytes(vertex.uv, sizeof(vertex.uv), hash);
+    }
+    return hash;
+}
+
+bool IsSameAlphaPayload(const utils::Texture* a, uint32_t aMipOffset, const utils::Texture* b, uint32_t bMipOffset, uint32_t mipNum) {
+    for (uint32_t mip = 0; mip < mipNum; ++mip) {
+        AlphaMipCache::SourceDesc aDesc = GetAlphaMipSourceDesc((const detexTexture*)a->mips[aMipOffset + mip]);
+        AlphaMipCache::SourceDesc bDesc = GetAlphaMipSourceDesc((const detexTexture*)b->mips[bMipOffset + mip]);
+        if (aDesc.size != bDesc.size || aDesc.format != bDesc.format || aDesc.width != bDesc.width || aDesc.height != bDesc.height)
+            return false;
+    }
+    return true;
+}
+
+AlphaCrop GetAlphaCrop(const float* uvMin, const float* uvMax, const utils::Texture* texture, uint32_t mipOffset, uint32_t mipNum) {
+    AlphaCrop crop = {};
+    crop.mipId = mipOffset + mipNum - 1;
+    const detexTexture* coarseMip = (const detexTexture*)texture->mips[crop.mipId];
+    crop.textureSize[0] = uint32_t(coarseMip->width);
+    crop.textureSize[1] = uint32_t(coarseMip->height);
+
+    for (uint32_t axis = 0; axis < 2; ++axis) {
+        uint32_t coarseSize = crop.textureSize[axis];
+        bool isBlockAligned = coarseSize % 4 == 0;
+        for (uint32_t mipId = mipOffset; mipId < crop.mipId; ++mipId) { // crop must stay block aligned and keep the same uv mapping in every baked mip
+            const detexTexture* mip = (const detexTexture*)texture->mips[mipId];
+            uint32_t size = uint32_t(axis == 0 ? mip->width : mip->height);
+            isBlockAligned &= size == coarseSize << (crop.mipId - mipId);
+        }
+
+        float blockBegin = std::floor(uvMin[axis] * float(coarseSize) / 4.0f) - 1.0f; // one block of margin for the filter footprint
+        float blockEnd = std::ceil(uvMax[axis] * float(coarseSize) / 4.0f) + 1.0f;
+        bool isValid = std::isfinite(blockBegin) && std::isfinite(blockEnd) && blockBegin < blockEnd && std::abs(blockBegin) < float(1 << 20);
+        if (!isBlockAligned || !isValid || (blockEnd - blockBegin) * 4.0f >= float(coarseSize))
+            continue; // the whole period is referenced
+
+        crop.origin[axis] = int32_t(blockBegin) * 4;
+        crop.size[axis] = uint32_t(blockEnd - blockBegin) * 4;
+    }
+    return crop;
+}
+
+static inline int32_t GetAlphaRegionOrigin(int32_t coarseOrigin, int64_t scale, int64_t size) { // texels wrap, so the origin is moved into the first period before it is narrowed
+    int64_t origin = (int64_t(coarseOrigin) * scale) % size;
+    return int32_t(origin < 0 ? origin + size : origin);
+}
+
+AlphaRegion GetAlphaRegion(const AlphaCrop& crop, const detexTexture* mip, uint32_t mipId) {
+    AlphaRegion region = {0, 0, uint32_t(mip->width), uint32_t(mip->height)};
+    int64_t scale = int64_t(1) << (crop.mipId - mipId);
+    if (crop.size[0]) {
+        region.x = GetAlphaRegionOrigin(crop.origin[0], scale, mip->width);
+        region.width = uint32_t(std::min(int64_t(crop.size[0]) * scale, int64_t(mip->width)));
+    }
+    if (crop.size[1]) {
+        region.y = GetAlphaRegionOrigin(crop.origin[1], scale, mip->height);
+        region.height = uint32_t(std::min(int64_t(crop.size[1]) * scale, int64_t(mip->height)));
+    }
+    return region;
+}
+
+nri::Format RemapUvsToAlphaCrop(const AlphaCrop& crop, const utils::UnpackedVertex* vertices, uint32_t vertexNum, std::vector<uint8_t>& outUvData) {
+    std::vector<float> uvs(size_t(vertexNum) * 2);
+    for (uint32_t i = 0; i < vertexNum; ++i) {
+        for (uint32_t axis = 0; axis < 2; ++axis) {
+            float uv = vertices[i].uv[axis];
+            if (crop.size[axis])
+                uv = (uv * float(crop.textureSize[axis]) - float(crop.origin[axis])) / float(crop.size[axis]);
+            uvs[size_t(i) * 2 + axis] = uv;
+        }
+    }
+
+    const uint32_t texelNum[] = {crop.size[0] ? crop.size[0] : crop.textureSize[0], crop.size[1] ? crop.size[1] : crop.textureSize[1]};
+    return EncodeOmmUvs(uvs, texelNum, outUvData);
+}
+
+void DecodeAlphaRows(const detexTexture* texture, const AlphaRegion& region, uint8_t* outAlphaChannel, uint32_t rowBegin, uint32_t rowEnd) {
+    int32_t width = texture->width;
+    int32_t height = texture->height;
+    if (!detexFormatIsCompressed(texture->format)) {
+        uint32_t pixelSize = detexGetPixelSize(texture->format);
+        auto extractAlpha = pixelSize == 4 ? ExtractAlpha8 : ExtractAlpha16;
+        uint32_t x = WrapTexel(region.x, width);
+        uint32_t headNum = std::min(region.width, uint32_t(width) - x); // region wraps around the right edge at most once
+        for (uint32_t row = rowBegin; row < rowEnd; ++row) {
+            const uint8_t* srcRow = texture->data + size_t(WrapTexel(region.y + int32_t(row), height)) * size_t(width) * pixelSize;
+            uint8_t* dstRow = outAlphaChannel + size_t(row) * region.width;
+            extractAlpha(srcRow + size_t(x) * pixelSize, dstRow, 0, headNum);
+            extractAlpha(srcRow, dstRow + headNum, 0, region.width - headNum);
+        }
+        return;
+    }
+
+    uint32_t format = texture->format == DETEX_TEXTURE_FORMAT_BC1 ? (uint32_t)DETEX_TEXTURE_FORMAT_BC1A : texture->format; // decode BC1 as BC1A to get alpha data
+    uint32_t blockSize = detexGetCompressedBlockSize(format);
+    int32_t blockOriginX = region.x / 4; // cropped regions are block aligned
+    int32_t blockOriginY = region.y / 4;
+    uint32_t regionBlockNumX = (region.width + 3) / 4;
+    uint8_t blockPixels[16 * 4];
+    uint8_t blockAlpha[16];
+    for (uint32_t blockY = rowBegin / 4; blockY < (rowEnd + 3) / 4; ++blockY) {
+        int32_t srcBlockY = WrapTexel(blockOriginY + int32_t(blockY), texture->height_in_blocks);
+        const uint8_t* blockRow = texture->data + size_t(srcBlockY) * size_t(texture->width_in_blocks) * blockSize;
+        uint32_t rowNum = std::min(4u, region.height - blockY * 4);
+        for (uint32_t blockX = 0; blockX < regionBlockNumX; ++blockX) {
+            const uint8_t* block = blockRow + size_t(WrapTexel(blockOriginX + int32_t(blockX), texture->width_in_blocks)) * blockSize;
+            if (!detexDecompressBlock(block, format, DETEX_MODE_MASK_ALL, 0, blockPixels, DETEX_PIXEL_FORMAT_RGBA8))
+                memset(blockPixels, 0, sizeof(blockPixels));
+            ExtractAlpha8(blockPixels, blockAlpha, 0, 16);
+
+            uint32_t columnNum = std::min(4u, region.width - blockX * 4);
+            for (uint32_t row = 0; row < rowNum; ++row)
+                memcpy(outAlphaChannel + size_t(blockY * 4 + row) * region.width + blockX * 4, blockAlpha + row * 4, columnNum);
+        }
+    }
+}
+
+#pragma endregion
+} // namespace ommhelper
@@ -0,0 +1,92 @@
+/*
+Copyright (c) 2022, NVIDIA CORPORATION. All rights reserved.
+
+NVIDIA CORPORATION and its licensors retain all intellectual property
+and proprietary rights in and to this software, related documentation
+and any modifications thereto. Any use, reproduction, disclosure or
+distribution of this software and related documentation without an express
+license agreement from NVIDIA CORPORATION is strictly prohibited.
+*/
+
+#pragma once
+
+// Scene side baker input preparation shared by the sample and the bake tool. Both write the same cache entries,
+// so they must feed the baker identical inputs
+
+#include <cmath>
+
+#include "OmmBakeCommon.h"
+
+#include "NRIFramework.h" // utils::Scene
+
+#include "../Detex/detex.h"
+
+namespace ommhelper {
+constexpr float OMM_UV_MAX_TEXEL_ERROR = 1.0f / 16.0f; // compact uv encodings are used only if no uv moves further than this, in texels of the finest alpha mip
+
+struct AlphaRegion { // texel rectangle of a mip decoded for the cpu baker. Origin lies within the mip, texels past its edges wrap as with REPEAT addressing
+    int32_t x;
+    int32_t y;
+    uint32_t width;
+    uint32_t height;
+};
+
+struct AlphaCrop { // uv-referenced part of a material texture in texels of its coarsest baked mip. Zero size means the axis is not cropped
+    int32_t origin[2];
+    uint32_t size[2];
+    uint32_t textureSize[2];
+    uint32_t mipId;
+};
+
+inline uint32_t GetOmmUvStride(nri::Format format) {
+    return format == nri::Format::RG32_SFLOAT ? sizeof(float) * 2 : sizeof(uint32_t);
+}
+
+inline uint32_t GetOmmIndexStride(nri::Format format) {
+    return format == nri::Format::R16_UINT ? sizeof(uint16_t) : sizeof(uint32_t);
+}
+
+inline bool IsAlphaCropped(const AlphaCrop& crop) {
+    return crop.size[0] != 0 || crop.size[1] != 0;
+}
+
+std::vector<uint32_t> FilterOutAlphaTestedGeometry(const utils::Scene& scene); // instance per unique mesh and material pair, cache entries are keyed by them
+void SetRuntimeAlphaParams(OmmBakeGeometryDesc& outDesc); // alpha test params must match the any-hit shader
+void ResolveGeometryBakeParams(const utils::Scene& scene, uint32_t meshIndex, uint32_t materialIndex, const OmmMaterialBakeParams& params, const OmmBakeDesc& bakeDesc, OmmBakeGeometryDesc& outDesc);
+uint32_t GetTexelDensitySubdivisionLevel(const utils::Scene& scene, uint32_t meshIndex, uint32_t materialIndex, const OmmBakeDesc& bakeDesc);
+void GetAlphaMipRange(const utils::Texture* texture, const OmmBakeDesc& bakeDesc, uint32_t& outMipOffset, uint32_t& outMipNum); // mips baked by the cpu baker
+void GetMeshUvRange(const utils::Scene& scene, const utils::Mesh& mesh, float outUvMin[2], float outUvMax[2]);
+
+nri::Format EncodeOmmUvs(const std::vector<float>& uvs, const uint32_t texelNum[2], std::vector<uint8_t>& outUvData); // narrowest format which keeps every uv within OMM_UV_MAX_TEXEL_ERROR
+nri::Format EncodeOmmMeshUvs(const utils::Scene& scene, const utils::Mesh& mesh, const utils::Texture* texture, std::vector<uint8_t>& outUvData); // against the finest mip of the texture
+nri::Format EncodeOmmIndices(const utils::Index* indices, size_t indexNum, std::vector<uint8_t>& outIndexData); // lossless, 8-bit indices are not supported by BLAS builds
+
+AlphaMipCache::SourceDesc GetAlphaMipSourceDesc(const detexTexture* mip);
+uint64_t CalculateAlphaMipContentHash(const detexTexture* mip);
+uint64_t CalculateAlphaTextureContentHash(const uint64_t* mipContentHashes, uint32_t mipNum); // baked mip range of a texture
+uint64_t CalculateMeshContentHash(const utils::Scene& scene, const utils::Mesh& mesh); // indices and uvs read by the bakers
+bool IsSameAlphaPayload(const utils::Texture* a, uint32_t aMipOffset, const utils::Texture* b, uint32_t bMipOffset, uint32_t mipNum); // confirms a content hash match before alpha sources are shared
+AlphaCrop GetAlphaCrop(const float* uvMin, const float* uvMax, const utils::Texture* texture, uint32_t mipOffset, uint32_t mipNum);
+AlphaRegion GetAlphaRegion(const AlphaCrop& crop, const detexTexture* mip, uint32_t mipId);
+nri::Format RemapUvsToAlphaCrop(const AlphaCrop& crop, const utils::UnpackedVertex* vertices, uint32_t vertexNum, std::vector<uint8_t>& outUvData); // re-encoded, the crop can allow a narrower format
+void DecodeAlphaRows(const detexTexture* texture, const AlphaRegion& region, uint8_t* outAlphaChannel, uint32_t rowBegin, uint32_t rowEnd); // rows are relative to the region, outAlphaChannel points to its first texel
+
+template <typename Func>
+void ForEachUvTriangleTexelArea(const utils::Scene& scene, uint32_t meshIndex, uint32_t materialIndex, uint32_t mipBias, Func func) { // uv-space triangle areas in texels of the baked mip
+    const utils::Mesh& mesh = scene.meshes[meshIndex];
+    const utils::Texture* texture = scene.textures[scene.materials[materialIndex].baseColorTexIndex];
+    uint32_t minMip = texture->GetMipNum() - 1;
+    const detexTexture* mip = (const detexTexture*)texture->mips[mipBias > minMip ? minMip : mipBias];
+    const float texelNum[] = {float(mip->width), float(mip->height)};
+
+    const utils::Index* indices = scene.indices.data() + mesh.indexOffset;
+    for (uint32_t triangle = 0; triangle < mesh.indexNum / 3; ++triangle) {
+        const float* uv0 = scene.unpackedVertices[mesh.vertexOffset + indices[triangle * 3 + 0]].uv;
+        const float* uv1 = scene.unpackedVertices[mesh.vertexOffset + indices[triangle * 3 + 1]].uv;
+        const float* uv2 = scene.unpackedVertices[mesh.vertexOffset + indices[triangle * 3 + 2]].uv;
+        float e1[] = {(uv1[0] - uv0[0]) * texelNum[0], (uv1[1] - uv0[1]) * texelNum[1]};
+        float e2[] = {(uv2[0] - uv0[0]) * texelNum[0], (uv2[1] - uv0[1]) * texelNum[1]};
+        func(0.5f * std::abs(e1[0] * e2[1] - e1[1] * e2[0]));
+    }
+}
+} // namespace ommhelper
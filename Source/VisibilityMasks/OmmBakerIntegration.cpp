@@ -9,6 +9,7 @@ license agreement from NVIDIA CORPORATION is strictly prohibited.
 */
 
 #include "OmmBakerIntegration.h"
+#include <filesystem>
 
 #define NRI_ABORT_ON_FAILURE(result) \
     if ((result) != nri::Result::SUCCESS) \
@@ -52,8 +53,11 @@ void OmmBakerGpuIntegration::Initialize(nri::Device& device) {
     {
         CreateStaticResources(commandQueue);
         CreateSamplers(m_PipelineInfo);
-        CreateTextures(m_PipelineInfo->pipelineNum);
-        CreatePipelines(m_PipelineInfo);
+
+        // pipelines are created by CreatePipeline on first use, a bake usually needs a fraction of them. The debug texture is created with the first pipeline rendering to it
+        m_NriPipelines.resize(m_PipelineInfo->pipelineNum, nullptr);
+        m_NriPipelineLayouts.resize(m_PipelineInfo->pipelineNum, nullptr);
+        m_ColorDescriptorPerPipeline.resize(m_PipelineInfo->pipelineNum, nullptr);
     }
 }
 
@@ -306,10 +310,10 @@ void OmmBakerGpuIntegration::CreateGraphicsPipeline(uint32_t pipelineId, const o
         layoutDesc.rootConstants = &pushConstantDesc;
         layoutDesc.rootConstantNum = 1;
     }
-    NRI_ABORT_ON_FAILURE(NRI.CreatePipelineLayout(*m_Device, layoutDesc, m_NriPipelineLayouts.emplace_back()));
+    NRI_ABORT_ON_FAILURE(NRI.CreatePipelineLayout(*m_Device, layoutDesc, m_NriPipelineLayouts[pipelineId]));
 
     nri::GraphicsPipelineDesc nriPipelineDesc = {};
-    nriPipelineDesc.pipelineLayout = m_NriPipelineLayouts.back();
+    nriPipelineDesc.pipelineLayout = m_NriPipelineLayouts[pipelineId];
     nriPipelineDesc.multisample = nullptr;
 
     nri::VertexInputDesc vertexInputDesc = {};
@@ -372,6 +376,8 @@ void OmmBakerGpuIntegration::CreateGraphicsPipeline(uint32_t pipelineId, const o
         outputMergerDesc.depth.write = false;
     }
 
+    if (outputMergerDesc.colorNum && !m_DebugTexture)
+        CreateDebugTexture();
     m_ColorDescriptorPerPipeline[pipelineId] = outputMergerDesc.colorNum ? m_DebugTextureDescriptor : m_EmptyDescriptor;
 
     std::vector<nri::ShaderDesc> shaderStages;
@@ -399,7 +405,7 @@ void OmmBakerGpuIntegration::CreateGraphicsPipeline(uint32_t pipelineId, const o
 
     nriPipelineDesc.shaders = shaderStages.data();
     nriPipelineDesc.shaderNum = (uint32_t)shaderStages.size();
-    NRI_ABORT_ON_FAILURE(NRI.CreateGraphicsPipeline(*m_Device, nriPipelineDesc, m_NriPipelines.emplace_back()));
+    NRI_ABORT_ON_FAILURE(NRI.CreateGraphicsPipeline(*m_Device, nriPipelineDesc, m_NriPipelines[pipelineId]));
 }
 
 void OmmBakerGpuIntegration::CreateComputePipeline(uint32_t id, const ommGpuPipelineInfoDesc* pipelineInfo) {
@@ -438,15 +444,15 @@ void OmmBakerGpuIntegration::CreateComputePipeline(uint32_t id, const ommGpuPipe
         layoutDesc.rootConstants = &pushConstantDesc;
         layoutDesc.rootConstantNum = 1;
     }
-    NRI_ABORT_ON_FAILURE(NRI.CreatePipelineLayout(*m_Device, layoutDesc, m_NriPipelineLayouts.emplace_back()));
+    NRI_ABORT_ON_FAILURE(NRI.CreatePipelineLayout(*m_Device, layoutDesc, m_NriPipelineLayouts[id]));
 
     nri::ComputePipelineDesc nriPipelineDesc = {};
-    nriPipelineDesc.pipelineLayout = m_NriPipelineLayouts.back();
+    nriPipelineDesc.pipelineLayout = m_NriPipelineLayouts[id];
     nriPipelineDesc.shader.bytecode = pipelineDesc.computeShader.data;
     nriPipelineDesc.shader.size = pipelineDesc.computeShader.size;
     nriPipelineDesc.shader.entryPointName = pipelineDesc.shaderEntryPointName;
     nriPipelineDesc.shader.stage = nri::StageBits::COMPUTE_SHADER;
-    NRI_ABORT_ON_FAILURE(NRI.CreateComputePipeline(*m_Device, nriPipelineDesc, m_NriPipelines.emplace_back()));
+    NRI_ABORT_ON_FAILURE(NRI.CreateComputePipeline(*m_Device, nriPipelineDesc, m_NriPipelines[id]));
 }
 
 inline void FillSamplerDesc(nri::SamplerDesc& nriDesc, const ommGpuStaticSamplerDesc& ommDesc) {
@@ -471,54 +477,139 @@ void OmmBakerGpuIntegration::CreateSamplers(const ommGpuPipelineInfoDesc* pipeli
     }
 }
 
-void OmmBakerGpuIntegration::CreateTextures(uint32_t pipelineNum) {
-    m_ColorDescriptorPerPipeline.resize(pipelineNum, nullptr);
-
-    { // create debug texture
-        constexpr uint16_t maxTexSize = 8042;
-        nri::TextureDesc textureDesc = {};
-        textureDesc.type = nri::TextureType::TEXTURE_2D;
-        textureDesc.usage = nri::TextureUsageBits::COLOR_ATTACHMENT;
-        textureDesc.layerNum = 1;
-        textureDesc.format = m_DebugTexFormat;
-        textureDesc.width = maxTexSize;
-        textureDesc.height = maxTexSize;
-        textureDesc.depth = 1;
-        textureDesc.sampleNum = 1;
-        textureDesc.mipNum = 1;
-        NRI_ABORT_ON_FAILURE(NRI.CreateTexture(*m_Device, textureDesc, m_DebugTexture));
-
-        nri::ResourceGroupDesc resourceGrpoupDesc = {};
-        resourceGrpoupDesc.textureNum = 1;
-        resourceGrpoupDesc.textures = &m_DebugTexture;
-        resourceGrpoupDesc.memoryLocation = nri::MemoryLocation::DEVICE;
-        NRI_ABORT_ON_FAILURE(NRI.AllocateAndBindMemory(*m_Device, resourceGrpoupDesc, &m_DebugTextureMemory));
-
-        nri::Texture2DViewDesc textureViewDesc = {};
-        textureViewDesc.viewType = nri::Texture2DViewType::COLOR_ATTACHMENT;
-        textureViewDesc.mipNum = 1;
-        textureViewDesc.mipOffset = 0;
-        textureViewDesc.format = m_DebugTexFormat;
-        textureViewDesc.texture = m_DebugTexture;
-        NRI.CreateTexture2DView(textureViewDesc, m_DebugTextureDescriptor);
+void OmmBakerGpuIntegration::CreateDebugTexture() { // render target of the pipelines with color outputs, created with the first of them
+    constexpr uint16_t maxTexSize = 8042;
+    nri::TextureDesc textureDesc = {};
+    textureDesc.type = nri::TextureType::TEXTURE_2D;
+    textureDesc.usage = nri::TextureUsageBits::COLOR_ATTACHMENT;
+    textureDesc.layerNum = 1;
+    textureDesc.format = m_DebugTexFormat;
+    textureDesc.width = maxTexSize;
+    textureDesc.height = maxTexSize;
+    textureDesc.depth = 1;
+    textureDesc.sampleNum = 1;
+    textureDesc.mipNum = 1;
+    NRI_ABORT_ON_FAILURE(NRI.CreateTexture(*m_Device, textureDesc, m_DebugTexture));
+
+    nri::ResourceGroupDesc resourceGrpoupDesc = {};
+    resourceGrpoupDesc.textureNum = 1;
+    resourceGrpoupDesc.textures = &m_DebugTexture;
+    resourceGrpoupDesc.memoryLocation = nri::MemoryLocation::DEVICE;
+    NRI_ABORT_ON_FAILURE(NRI.AllocateAndBindMemory(*m_Device, resourceGrpoupDesc, &m_DebugTextureMemory));
+
+    nri::Texture2DViewDesc textureViewDesc = {};
+    textureViewDesc.viewType = nri::Texture2DViewType::COLOR_ATTACHMENT;
+    textureViewDesc.mipNum = 1;
+    textureViewDesc.mipOffset = 0;
+    textureViewDesc.format = m_DebugTexFormat;
+    textureViewDesc.texture = m_DebugTexture;
+    NRI.CreateTexture2DView(textureViewDesc, m_DebugTextureDescriptor);
+}
+
+// NRI has no pipeline cache API: it exposes neither VkPipelineCache nor D3D12 pipeline libraries, so the compiled binaries
+// are left to the driver shader cache. What is persisted instead is the set of pipelines a session created, see SavePipelineCache()
+void OmmBakerGpuIntegration::CreatePipeline(uint32_t pipelineIndex) {
+    const ommGpuPipelineDesc& ommPipelineDesc = m_PipelineInfo->pipelines[pipelineIndex];
+    switch (ommPipelineDesc.type) {
+        case ommGpuPipelineType_Compute:
+            CreateComputePipeline(pipelineIndex, m_PipelineInfo);
+            break;
+        case ommGpuPipelineType_Graphics:
+            CreateGraphicsPipeline(pipelineIndex, m_PipelineInfo);
+            break;
+        default:
+            printf("[FAIL] Invalid ommGpuPipelineType\n");
+            std::abort();
     }
 }
 
-void OmmBakerGpuIntegration::CreatePipelines(const ommGpuPipelineInfoDesc* pipelinesInfo) {
-    for (uint32_t i = 0; i < pipelinesInfo->pipelineNum; ++i) {
-        const ommGpuPipelineDesc& ommPipelineDesc = pipelinesInfo->pipelines[i];
-        switch (ommPipelineDesc.type) {
-            case ommGpuPipelineType_Compute:
-                CreateComputePipeline(i, pipelinesInfo);
-                break;
-            case ommGpuPipelineType_Graphics:
-                CreateGraphicsPipeline(i, pipelinesInfo);
-                break;
-            default:
-                printf("[FAIL] Invalid ommGpuPipelineType\n");
-                std::abort();
+constexpr uint64_t PIPELINE_CACHE_MAGIC = 0x31455049504D4D4F; // "OMMPIPE1"
+
+struct PipelineCacheHeader {
+    uint64_t magic;
+    uint64_t key; // render API and shader bytecode, a new SDK invalidates the file
+    uint32_t pipelineNum;
+    uint32_t indexNum; // followed by the indices of the created pipelines
+};
+
+uint64_t OmmBakerGpuIntegration::CalculatePipelineCacheKey() const {
+    uint64_t key = HashMix(uint64_t(NRI.GetDeviceDesc(*m_Device).graphicsAPI) << 32 | m_PipelineInfo->pipelineNum);
+    auto hashShader = [&](const auto& shader) {
+        if (shader.data)
+            key = HashBytes(shader.data, shader.size, key);
+    };
+
+    for (uint32_t i = 0; i < m_PipelineInfo->pipelineNum; ++i) {
+        const ommGpuPipelineDesc& pipelineDesc = m_PipelineInfo->pipelines[i];
+        if (pipelineDesc.type == ommGpuPipelineType_Compute)
+            hashShader(pipelineDesc.compute.computeShader);
+        else {
+            hashShader(pipelineDesc.graphics.vertexShader);
+            hashShader(pipelineDesc.graphics.geometryShader);
+            hashShader(pipelineDesc.graphics.pixelShader);
         }
     }
+    return key;
+}
+
+void OmmBakerGpuIntegration::CreateCachedPipelines(const char* filename) {
+    FILE* file = fopen(filename, "rb");
+    if (file == nullptr)
+        return; // no GPU bake in a previous session
+
+    PipelineCacheHeader header = {};
+    std::vector<uint32_t> pipelineIndices;
+    bool isValid = fread(&header, 1, sizeof(header), file) == sizeof(header);
+    isValid = isValid && header.magic == PIPELINE_CACHE_MAGIC && header.key == CalculatePipelineCacheKey() && header.pipelineNum == m_PipelineInfo->pipelineNum && header.indexNum <= header.pipelineNum;
+    if (isValid) {
+        pipelineIndices.resize(header.indexNum);
+        isValid = fread(pipelineIndices.data(), sizeof(uint32_t), header.indexNum, file) == header.indexNum;
+    }
+    fclose(file);
+
+    if (!isValid) {
+        printf("[WARNING] Pipeline cache is outdated or corrupted, ignored: {%s}\n", filename);
+        return;
+    }
+
+    for (uint32_t pipelineIndex : pipelineIndices) {
+        if (pipelineIndex < header.pipelineNum && m_NriPipelines[pipelineIndex] == nullptr)
+            CreatePipeline(pipelineIndex);
+    }
+}
+
+void OmmBakerGpuIntegration::SavePipelineCache(const char* filename) {
+    std::vector<uint32_t> pipelineIndices;
+    for (uint32_t i = 0; i < (uint32_t)m_NriPipelines.size(); ++i) {
+        if (m_NriPipelines[i])
+            pipelineIndices.push_back(i);
+    }
+    if (pipelineIndices.empty())
+        return; // nothing was baked on the GPU, keep the previous file
+
+    std::string tmpFilename = std::string(filename) + ".tmp"; // written aside and renamed so a partially written list is never read
+    FILE* file = fopen(tmpFilename.c_str(), "wb");
+    if (file == nullptr) {
+        printf("[FAIL] Unable to open file for writing: {%s}\n", tmpFilename.c_str());
+        return;
+    }
+
+    PipelineCacheHeader header = {};
+    header.magic = PIPELINE_CACHE_MAGIC;
+    header.key = CalculatePipelineCacheKey();
+    header.pipelineNum = m_PipelineInfo->pipelineNum;
+    header.indexNum = (uint32_t)pipelineIndices.size();
+    bool success = fwrite(&header, 1, sizeof(header), file) == sizeof(header);
+    success = success && fwrite(pipelineIndices.data(), sizeof(uint32_t), pipelineIndices.size(), file) == pipelineIndices.size();
+    fclose(file);
+
+    std::error_code error;
+    if (success)
+        std::filesystem::rename(tmpFilename, filename, error);
+    if (!success || error) {
+        printf("[FAIL] Unable to write to file: {%s}\n", filename);
+        std::filesystem::remove(tmpFilename, error);
+    }
 }
 
 void OmmBakerGpuIntegration::CreateStaticResources(nri::Queue* commandQueue) {
@@ -647,62 +738,71 @@ void OmmBakerGpuIntegration::AddGeometryToQueue(InputGeometryDesc* geometryDesc,
 
 void OmmBakerGpuIntegration::UpdateGlobalConstantBuffer() {
     const nri::DeviceDesc& deviceDesc = NRI.GetDeviceDesc(*m_Device);
-    uint32_t newConstantBufferViewSize = GetAlignedSize(m_PipelineInfo->globalConstantBufferDesc.maxDataSize, uint32_t(deviceDesc.memoryAlignment.constantBufferOffset));
-    uint32_t newConstantBufferSize = newConstantBufferViewSize * (uint32_t)m_GeometryQueue.size();
-
-    if (m_ConstantBufferSize < newConstantBufferSize) {
-        m_ConstantBufferSize = newConstantBufferSize;
-        m_ConstantBufferViewStride = 0;
-        if (m_ConstantBuffer)
-            NRI.DestroyBuffer(m_ConstantBuffer);
+    m_ConstantBufferViewStride = GetAlignedSize(m_PipelineInfo->globalConstantBufferDesc.maxDataSize, uint32_t(deviceDesc.memoryAlignment.constantBufferOffset));
+
+    uint32_t geometryNum = (uint32_t)m_GeometryQueue.size();
+    uint32_t slotNum = (uint32_t)m_ConstantBufferRing.views.size();
+    if (m_ConstantBufferNextSlot + geometryNum > slotNum) { // grow geometrically, so a bake settles on one buffer after a few submissions
+        if (m_ConstantBufferRing.buffer)
+            m_RetiredConstantBufferRings.push_back(m_ConstantBufferRing);
+        m_ConstantBufferRing = {};
+        m_ConstantBufferNextSlot = 0;
+        slotNum = std::max(slotNum * 2, geometryNum);
+
         nri::BufferDesc bufferDesc = {};
-        bufferDesc.size = m_ConstantBufferSize;
+        bufferDesc.size = uint64_t(m_ConstantBufferViewStride) * slotNum;
         bufferDesc.usage = nri::BufferUsageBits::CONSTANT_BUFFER;
-        NRI_ABORT_ON_FAILURE(NRI.CreateBuffer(*m_Device, bufferDesc, m_ConstantBuffer));
+        NRI_ABORT_ON_FAILURE(NRI.CreateBuffer(*m_Device, bufferDesc, m_ConstantBufferRing.buffer));
 
         nri::ResourceGroupDesc resourceGroupDesc = {};
-        resourceGroupDesc = {};
         resourceGroupDesc.memoryLocation = nri::MemoryLocation::HOST_UPLOAD;
         resourceGroupDesc.bufferNum = 1;
-        resourceGroupDesc.buffers = &m_ConstantBuffer;
-        NRI_ABORT_ON_FAILURE(NRI.AllocateAndBindMemory(*m_Device, resourceGroupDesc, &m_ConstantBufferHeap));
-    }
-
-    if (m_ConstantBufferViewStride < newConstantBufferViewSize) {
-        m_ConstantBufferViewStride = newConstantBufferViewSize;
-        if (m_ConstantBufferViews.empty() == false){
-            for(auto& view : m_ConstantBufferViews){
-                NRI.DestroyDescriptor(view);
-            }
-        }
+        resourceGroupDesc.buffers = &m_ConstantBufferRing.buffer;
+        NRI_ABORT_ON_FAILURE(NRI.AllocateAndBindMemory(*m_Device, resourceGroupDesc, &m_ConstantBufferRing.memory));
+        m_ConstantBufferRing.data = (uint8_t*)NRI.MapBuffer(*m_ConstantBufferRing.buffer, 0, bufferDesc.size);
 
-        m_ConstantBufferViews.resize((uint32_t)m_GeometryQueue.size());
+        m_ConstantBufferRing.views.resize(slotNum);
         nri::BufferViewDesc constantBufferViewDesc = {};
         constantBufferViewDesc.viewType = nri::BufferViewType::CONSTANT;
-        constantBufferViewDesc.buffer = m_ConstantBuffer;
+        constantBufferViewDesc.buffer = m_ConstantBufferRing.buffer;
         constantBufferViewDesc.size = m_ConstantBufferViewStride;
-
-        for(uint64_t i = 0; i < (uint64_t)m_GeometryQueue.size(); ++i) {
-            constantBufferViewDesc.offset = m_ConstantBufferViewStride * i;
-            NRI_ABORT_ON_FAILURE(NRI.CreateBufferView(constantBufferViewDesc, m_ConstantBufferViews[i]));
+        for (uint32_t i = 0; i < slotNum; ++i) {
+            constantBufferViewDesc.offset = uint64_t(m_ConstantBufferViewStride) * i;
+            NRI_ABORT_ON_FAILURE(NRI.CreateBufferView(constantBufferViewDesc, m_ConstantBufferRing.views[i]));
         }
     }
+
+    for (GeometryQueueInstance& instance : m_GeometryQueue)
+        instance.constantBufferSlot = m_ConstantBufferNextSlot++;
 }
 
-inline uint64_t ComputeHash(const void* key, uint32_t len, uint32_t geometryId) {
-    const uint8_t* p = (uint8_t*)key;
-    uint64_t result = 14695981039346656037ull - geometryId;
-    while (len--)
-        result = (result ^ (*p++)) * 1099511628211ull;
+void OmmBakerGpuIntegration::DestroyConstantBufferRing(ConstantBufferRing& ring) {
+    for (nri::Descriptor* view : ring.views)
+        NRI.DestroyDescriptor(view);
+    if (ring.buffer) {
+        NRI.UnmapBuffer(*ring.buffer);
+        NRI.DestroyBuffer(ring.buffer);
+    }
+    if (ring.memory)
+        NRI.FreeMemory(ring.memory);
+    ring = {};
+}
 
-    return result;
+inline uint64_t ComputeHash(const void* key, uint32_t len, uint32_t geometryId) {
+    return HashBytes(key, len, 14695981039346656037ull - geometryId);
 }
 
-void OmmBakerGpuIntegration::UpdateDescriptorPool(uint32_t geometryId, const ommGpuDispatchChain* dispatchChain) {
-    nri::DescriptorPool*& desctriptorPool = m_NriDescriptorPools[geometryId];
-    if (desctriptorPool)
-        NRI.DestroyDescriptorPool(desctriptorPool);
+static uint32_t nri::DescriptorPoolDesc::*const DescriptorPoolCounters[] = {
+    &nri::DescriptorPoolDesc::descriptorSetMaxNum,
+    &nri::DescriptorPoolDesc::textureMaxNum,
+    &nri::DescriptorPoolDesc::bufferMaxNum,
+    &nri::DescriptorPoolDesc::structuredBufferMaxNum,
+    &nri::DescriptorPoolDesc::storageStructuredBufferMaxNum,
+    &nri::DescriptorPoolDesc::constantBufferMaxNum,
+    &nri::DescriptorPoolDesc::samplerMaxNum,
+};
 
+void OmmBakerGpuIntegration::UpdateDescriptorPool(uint32_t geometryId, const ommGpuDispatchChain* dispatchChain) {
     nri::DescriptorPoolDesc desc = {};
     uint32_t dispatchNum = 0;
     uint32_t uniqueDescriptorSetNum = 0;
@@ -713,9 +813,8 @@ void OmmBakerGpuIntegration::UpdateDescriptorPool(uint32_t geometryId, const omm
                 break;
             default: {
                 uint64_t hash = ComputeHash(dispatchChain->dispatches[i].compute.resources, dispatchChain->dispatches[i].compute.resourceNum * sizeof(ommGpuResource), geometryId);
-                const auto& it = m_NriDescriptorSets.find(hash);
-                if (it == m_NriDescriptorSets.end()) {
-                    m_NriDescriptorSets.insert(std::make_pair(hash, nullptr));
+                if (m_NriDescriptorSets.Find(hash) == nullptr) {
+                    m_NriDescriptorSets.Insert(hash, nullptr);
                     ++uniqueDescriptorSetNum;
 
                     for (uint32_t j = 0; j < dispatchChain->dispatches[i].compute.resourceNum; ++j) {
@@ -746,92 +845,98 @@ void OmmBakerGpuIntegration::UpdateDescriptorPool(uint32_t geometryId, const omm
     desc.descriptorSetMaxNum = uniqueDescriptorSetNum;
     desc.constantBufferMaxNum = dispatchNum;
     desc.samplerMaxNum = uniqueDescriptorSetNum * (uint32_t)m_Samplers.size();
-    NRI_ABORT_ON_FAILURE(NRI.CreateDescriptorPool(*m_Device, desc, desctriptorPool));
-}
 
-uint64_t CalculateDescriptorKey(uint32_t geometryId, const ommGpuResource& resource) {
-    bool isTransientPool = resource.type == ommGpuResourceType_TRANSIENT_POOL_BUFFER;
-    uint64_t key = isTransientPool ? 0 : geometryId + 1;
-    key |= uint64_t(resource.type) << 32ull;
-    key |= uint64_t(resource.stateNeeded) << 40ull;
-    key |= uint64_t(resource.indexInPool) << 48ull;
-    return key;
-}
+    bool isPoolFull = m_NriDescriptorPool == nullptr;
+    for (auto counter : DescriptorPoolCounters)
+        isPoolFull |= m_DescriptorPoolUsage.*counter + desc.*counter > m_DescriptorPoolCapacity.*counter;
 
-nri::Descriptor* OmmBakerGpuIntegration::GetDescriptor(const ommGpuResource& resource, uint32_t geometryId) {
-    uint64_t key = CalculateDescriptorKey(geometryId, resource);
-    nri::Descriptor* descriptor = nullptr;
-    const auto& it = m_NriDescriptors.find(key);
-    if (it == m_NriDescriptors.end()) {
-        BakerInputs& inputs = m_GeometryQueue[geometryId].desc->inputs;
-        bool isTexture = resource.stateNeeded == ommGpuDescriptorType_TextureRead;
-        bool isRaw = (resource.stateNeeded == ommGpuDescriptorType_RawBufferRead) || (resource.stateNeeded == ommGpuDescriptorType_RawBufferWrite);
-        if (isTexture) {
-            nri::Texture2DViewDesc texDesc = {};
-            texDesc.mipNum = 1;
-            texDesc.mipOffset = nri::Dim_t(inputs.inTexture.mipOffset);
-            texDesc.viewType = nri::Texture2DViewType::SHADER_RESOURCE_2D;
-            texDesc.format = inputs.inTexture.format;
-            texDesc.texture = inputs.inTexture.texture;
-            NRI_ABORT_ON_FAILURE(NRI.CreateTexture2DView(texDesc, descriptor));
-        } else {
-            const BufferResource& buffer = GetBuffer(resource, geometryId);
-            nri::BufferViewDesc bufferDesc = {};
-            bufferDesc.buffer = buffer.buffer;
-            bufferDesc.offset = buffer.offset;
-            bufferDesc.format = isRaw ? nri::Format::UNKNOWN : buffer.format;
-            bufferDesc.size = buffer.size - buffer.offset;
-            bufferDesc.viewType = GetNriBufferViewType(resource.stateNeeded);
-            NRI_ABORT_ON_FAILURE(NRI.CreateBufferView(bufferDesc, descriptor));
-        }
-        m_NriDescriptors.insert(std::make_pair(key, descriptor));
-    } else
-        descriptor = it->second;
+    if (isPoolFull) { // grow geometrically, so a bake settles on one pool after a few submissions
+        if (m_NriDescriptorPool)
+            m_RetiredDescriptorPools.push_back(m_NriDescriptorPool);
 
-    return descriptor;
-}
+        for (auto counter : DescriptorPoolCounters)
+            m_DescriptorPoolCapacity.*counter = std::max(m_DescriptorPoolCapacity.*counter * 2, desc.*counter);
+        m_DescriptorPoolUsage = {};
+        NRI_ABORT_ON_FAILURE(NRI.CreateDescriptorPool(*m_Device, m_DescriptorPoolCapacity, m_NriDescriptorPool));
+    }
 
-void OmmBakerGpuIntegration::PerformResourceTransition(const ommGpuResource& resource, uint32_t geometryId, std::vector<nri::BufferBarrierDesc>& bufferBarriers) {
-    if (resource.type == ommGpuResourceType_IN_ALPHA_TEXTURE)
-        return;
+    for (auto counter : DescriptorPoolCounters)
+        m_DescriptorPoolUsage.*counter += desc.*counter;
+    m_GeometryQueue[geometryId].descriptorPool = m_NriDescriptorPool; // bound by FlushBatch when it changes
+}
 
-    BufferResource& bufferResource = GetBuffer(resource, geometryId);
-    nri::AccessBits currentState = bufferResource.state;
-    nri::AccessBits requestedState = GetNriResourceState(resource.stateNeeded);
+nri::Descriptor* OmmBakerGpuIntegration::GetDescriptor(const ommGpuResource& resource, uint32_t geometryId) { // views are shared by all geometries and bakes referencing the same range
+    BakerInputs& inputs = m_GeometryQueue[geometryId].desc->inputs;
+    bool isTexture = resource.stateNeeded == ommGpuDescriptorType_TextureRead;
+    bool isRaw = (resource.stateNeeded == ommGpuDescriptorType_RawBufferRead) || (resource.stateNeeded == ommGpuDescriptorType_RawBufferWrite);
+
+    ViewKey key;
+    const BufferResource* buffer = nullptr;
+    if (isTexture)
+        key = ViewKey(inputs.inTexture.texture, inputs.inTexture.mipOffset, 0, inputs.inTexture.format, (uint32_t)nri::Texture2DViewType::SHADER_RESOURCE_2D);
+    else {
+        buffer = &GetBuffer(resource, geometryId);
+        key = ViewKey(buffer->buffer, buffer->offset, buffer->size - buffer->offset, isRaw ? nri::Format::UNKNOWN : buffer->format, (uint32_t)GetNriBufferViewType(resource.stateNeeded));
+    }
 
-    if (currentState != requestedState) {
-        nri::BufferBarrierDesc& barrier = bufferBarriers.emplace_back();
-        barrier.before.access = currentState;
-        barrier.before.stages = nri::StageBits::ALL;
-        barrier.after.access = requestedState;
-        barrier.after.stages = nri::StageBits::ALL;
-        barrier.buffer = bufferResource.buffer;
+    nri::Descriptor** cachedDescriptor = m_NriDescriptors.Find(key);
+    if (cachedDescriptor)
+        return *cachedDescriptor;
 
-        bufferResource.state = requestedState;
+    nri::Descriptor* descriptor = nullptr;
+    if (isTexture) {
+        nri::Texture2DViewDesc texDesc = {};
+        texDesc.mipNum = 1;
+        texDesc.mipOffset = nri::Dim_t(inputs.inTexture.mipOffset);
+        texDesc.viewType = nri::Texture2DViewType::SHADER_RESOURCE_2D;
+        texDesc.format = inputs.inTexture.format;
+        texDesc.texture = inputs.inTexture.texture;
+        NRI_ABORT_ON_FAILURE(NRI.CreateTexture2DView(texDesc, descriptor));
+    } else {
+        nri::BufferViewDesc bufferDesc = {};
+        bufferDesc.buffer = buffer->buffer;
+        bufferDesc.offset = buffer->offset;
+        bufferDesc.format = std::get<3>(key);
+        bufferDesc.size = std::get<2>(key);
+        bufferDesc.viewType = GetNriBufferViewType(resource.stateNeeded);
+        NRI_ABORT_ON_FAILURE(NRI.CreateBufferView(bufferDesc, descriptor));
     }
+    m_NriDescriptors.Insert(key, descriptor);
+
+    return descriptor;
+}
+
+void OmmBakerGpuIntegration::ReleaseResourceViews(const void* resource) {
+    m_NriDescriptors.EraseIf([&](const ViewKey& key, nri::Descriptor* view) {
+        if (std::get<0>(key) != resource)
+            return false;
+        NRI.DestroyDescriptor(view);
+        return true;
+    });
 }
 
 nri::DescriptorSet* OmmBakerGpuIntegration::PrepareDispatch(nri::CommandBuffer& commandBuffer, const ommGpuResource* resources, uint32_t resourceNum, uint32_t pipelineIndex, uint32_t geometryId) {
+    if (m_NriPipelines[pipelineIndex] == nullptr)
+        CreatePipeline(pipelineIndex);
     nri::PipelineLayout*& pipelineLayout = m_NriPipelineLayouts[pipelineIndex];
 
     // Descriptor set
     uint64_t hash = ComputeHash(resources, resourceNum * sizeof(ommGpuResource), geometryId);
-    const auto& it = m_NriDescriptorSets.find(hash);
+    nri::DescriptorSet*& cachedDescriptorSet = *m_NriDescriptorSets.Find(hash); // added by UpdateDescriptorPool
     nri::DescriptorSet* descriptorSet = nullptr;
     bool updateRanges = false;
-    if (it->second == nullptr) {
-        NRI_ABORT_ON_FAILURE(NRI.AllocateDescriptorSets(*m_NriDescriptorPools[geometryId], *pipelineLayout, 0, &descriptorSet, 1, 0));
-        it->second = descriptorSet;
+    if (cachedDescriptorSet == nullptr) {
+        NRI_ABORT_ON_FAILURE(NRI.AllocateDescriptorSets(*m_GeometryQueue[geometryId].descriptorPool, *pipelineLayout, 0, &descriptorSet, 1, 0));
+        cachedDescriptorSet = descriptorSet;
         updateRanges = true;
     } else
-        descriptorSet = it->second;
+        descriptorSet = cachedDescriptorSet;
 
-    // process requested resources. prepare range updates. perform transitions
+    // process requested resources. prepare range updates. transitions are done by FlushBatch
     std::vector<nri::Descriptor*> descriptors;
     descriptors.resize(resourceNum);
 
     std::vector<nri::UpdateDescriptorRangeDesc> rangeUpdateDescs;
-    std::vector<nri::BufferBarrierDesc> bufferTransitions;
     nri::DescriptorType prevRangeType = nri::DescriptorType::MAX_NUM;
     for (uint32_t i = 0; i < resourceNum; ++i) {
         const ommGpuResource& resource = resources[i];
@@ -848,7 +953,6 @@ nri::DescriptorSet* OmmBakerGpuIntegration::PrepareDispatch(nri::CommandBuffer&
         descriptors[i] = GetDescriptor(resources[i], geometryId);
         currentRange.descriptorNum += 1;
         currentRange.descriptorSet = descriptorSet;
-        PerformResourceTransition(resource, geometryId, bufferTransitions);
     }
 
     nri::UpdateDescriptorRangeDesc& staticSamlersRange = rangeUpdateDescs.emplace_back();
@@ -859,7 +963,7 @@ nri::DescriptorSet* OmmBakerGpuIntegration::PrepareDispatch(nri::CommandBuffer&
     staticSamlersRange.rangeIndex = uint32_t(rangeUpdateDescs.size() - 1);
 
     nri::UpdateDescriptorRangeDesc& constantBufferRange = rangeUpdateDescs.emplace_back();
-    constantBufferRange.descriptors = &m_ConstantBufferViews[geometryId];
+    constantBufferRange.descriptors = &m_ConstantBufferRing.views[m_GeometryQueue[geometryId].constantBufferSlot];
     constantBufferRange.descriptorNum = 1;
     constantBufferRange.descriptorSet = descriptorSet;
     constantBufferRange.baseDescriptor = 0;
@@ -869,36 +973,42 @@ nri::DescriptorSet* OmmBakerGpuIntegration::PrepareDispatch(nri::CommandBuffer&
         NRI.UpdateDescriptorRanges(rangeUpdateDescs.data(), (uint32_t) rangeUpdateDescs.size());
     }
 
-    nri::BarrierDesc transitionBarriers = {};
-    transitionBarriers.bufferNum = (uint32_t)bufferTransitions.size();
-    transitionBarriers.buffers = bufferTransitions.data();
-    if (transitionBarriers.bufferNum)
-        NRI.CmdBarrier(commandBuffer, transitionBarriers);
-
-    nri::BindPoint bindPoint = m_PipelineInfo->pipelines[pipelineIndex].type == ommGpuPipelineType::ommGpuPipelineType_Graphics ? nri::BindPoint::GRAPHICS : nri::BindPoint::COMPUTE; 
-    NRI.CmdSetPipelineLayout(commandBuffer, bindPoint, *pipelineLayout);
+    // skip binds already done by the previous dispatch of the batch
+    nri::BindPoint bindPoint = m_PipelineInfo->pipelines[pipelineIndex].type == ommGpuPipelineType::ommGpuPipelineType_Graphics ? nri::BindPoint::GRAPHICS : nri::BindPoint::COMPUTE;
+    if (pipelineLayout != m_BoundPipelineLayout || bindPoint != m_BoundBindPoint) {
+        NRI.CmdSetPipelineLayout(commandBuffer, bindPoint, *pipelineLayout);
+        m_BoundPipelineLayout = pipelineLayout;
+        m_BoundBindPoint = bindPoint;
+        m_BoundDescriptorSet = nullptr; // bound sets don't survive a layout change
+        ++m_BindStats.pipelineLayoutNum;
+    } else
+        ++m_BindStats.pipelineLayoutSkippedNum;
 
-    NRI.CmdSetPipeline(commandBuffer, *m_NriPipelines[pipelineIndex]);
+    nri::Pipeline* pipeline = m_NriPipelines[pipelineIndex];
+    if (pipeline != m_BoundPipeline) {
+        NRI.CmdSetPipeline(commandBuffer, *pipeline);
+        m_BoundPipeline = pipeline;
+        ++m_BindStats.pipelineNum;
+    } else
+        ++m_BindStats.pipelineSkippedNum;
 
     return descriptorSet;
 }
 
-void OmmBakerGpuIntegration::InsertUavBarriers(nri::CommandBuffer& commandBuffer, const ommGpuResource* resources, uint32_t resourceNum, uint32_t geometryId) {
-    std::vector<nri::BufferBarrierDesc> uavBarriers;
-    for (uint32_t i = 0; i < resourceNum; ++i) {
-        if (resources[i].stateNeeded == ommGpuDescriptorType_RawBufferWrite) {
-            nri::BufferBarrierDesc barrier = {
-                GetBuffer(resources[i], geometryId).buffer,
-                {nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::StageBits::ALL},
-                {nri::AccessBits::SHADER_RESOURCE_STORAGE, nri::StageBits::ALL},
-            };
-            uavBarriers.push_back(barrier);
-        }
+void OmmBakerGpuIntegration::SetDescriptorSet(nri::CommandBuffer& commandBuffer, nri::DescriptorSet* descriptorSet) {
+    if (descriptorSet == m_BoundDescriptorSet) {
+        ++m_BindStats.descriptorSetSkippedNum;
+        return;
     }
-    nri::BarrierDesc transition = {};
-    transition.bufferNum = (uint32_t)uavBarriers.size();
-    transition.buffers = uavBarriers.data();
-    NRI.CmdBarrier(commandBuffer, transition);
+
+    nri::SetDescriptorSetDesc setDescriptorSetDesc = {};
+    setDescriptorSetDesc.bindPoint = nri::BindPoint::INHERIT;
+    setDescriptorSetDesc.descriptorSet = descriptorSet;
+    setDescriptorSetDesc.setIndex = 0;
+    NRI.CmdSetDescriptorSet(commandBuffer, setDescriptorSetDesc);
+
+    m_BoundDescriptorSet = descriptorSet;
+    ++m_BindStats.descriptorSetNum;
 }
 
 void OmmBakerGpuIntegration::DispatchCompute(nri::CommandBuffer& commandBuffer, const ommGpuComputeDesc& desc, uint32_t geometryId) {
@@ -914,20 +1024,13 @@ void OmmBakerGpuIntegration::DispatchCompute(nri::CommandBuffer& commandBuffer,
         NRI.CmdSetRootConstants(commandBuffer, rootConstantsDesc);
     }
 
-    {
-        nri::SetDescriptorSetDesc setDescriptorSetDesc = {};
-        setDescriptorSetDesc.bindPoint = nri::BindPoint::INHERIT;
-        setDescriptorSetDesc.descriptorSet = descriptorSet;
-        setDescriptorSetDesc.setIndex = 0;
-        NRI.CmdSetDescriptorSet(commandBuffer, setDescriptorSetDesc);
-    }
+    SetDescriptorSet(commandBuffer, descriptorSet);
 
     nri::DispatchDesc dispatchDesc = {};
     dispatchDesc.x = desc.gridWidth;
     dispatchDesc.y = desc.gridHeight;
     dispatchDesc.z = 1;
     NRI.CmdDispatch(commandBuffer, dispatchDesc);
-    InsertUavBarriers(commandBuffer, desc.resources, desc.resourceNum, geometryId);
 }
 
 void OmmBakerGpuIntegration::DispatchComputeIndirect(nri::CommandBuffer& commandBuffer, const ommGpuComputeIndirectDesc& desc, uint32_t geometryId) {
@@ -942,32 +1045,10 @@ void OmmBakerGpuIntegration::DispatchComputeIndirect(nri::CommandBuffer& command
         NRI.CmdSetRootConstants(commandBuffer, rootConstantsDesc);
     }
 
-    {
-        nri::SetDescriptorSetDesc setDescriptorSetDesc = {};
-        setDescriptorSetDesc.bindPoint = nri::BindPoint::INHERIT;
-        setDescriptorSetDesc.descriptorSet = descriptorSet;
-        setDescriptorSetDesc.setIndex = 0;
-        NRI.CmdSetDescriptorSet(commandBuffer, setDescriptorSetDesc);
-    }
-
-    BufferResource& argBuffer = GetBuffer(desc.indirectArg, geometryId);
-    if (argBuffer.state != nri::AccessBits::ARGUMENT_BUFFER) {
-        nri::BufferBarrierDesc bufferBarrier = {};
-        bufferBarrier.buffer = argBuffer.buffer;
-        bufferBarrier.before.access = argBuffer.state;
-        bufferBarrier.before.stages = nri::StageBits::ALL;
-        bufferBarrier.after.access = nri::AccessBits::ARGUMENT_BUFFER;
-        bufferBarrier.after.stages = nri::StageBits::ALL;
-
-        nri::BarrierDesc transition = {};
-        transition.bufferNum = 1;
-        transition.buffers = &bufferBarrier;
-        NRI.CmdBarrier(commandBuffer, transition);
-
-        argBuffer.state = nri::AccessBits::ARGUMENT_BUFFER;
-    }
-    NRI.CmdDispatchIndirect(commandBuffer, *argBuffer.buffer, desc.indirectArgByteOffset);
-    InsertUavBarriers(commandBuffer, desc.resources, desc.resourceNum, geometryId);
+    SetDescriptorSet(commandBuffer, descriptorSet);
+
+    BufferResource& argBuffer = GetBuffer(desc.indirectArg, geometryId); // in ARGUMENT_BUFFER state, see AddToBatch
+    NRI.CmdDispatchIndirect(commandBuffer, *argBuffer.buffer, argBuffer.offset + desc.indirectArgByteOffset); // offsets are relative to the resource, which can be a slice of a shared buffer
 }
 
 void OmmBakerGpuIntegration::DispatchDrawIndexedIndirect(nri::CommandBuffer& commandBuffer, const ommGpuDrawIndexedIndirectDesc& desc, uint32_t geometryId) {
@@ -982,30 +1063,9 @@ void OmmBakerGpuIntegration::DispatchDrawIndexedIndirect(nri::CommandBuffer& com
         NRI.CmdSetRootConstants(commandBuffer, rootConstantsDesc);
     }
 
-    {
-        nri::SetDescriptorSetDesc setDescriptorSetDesc = {};
-        setDescriptorSetDesc.bindPoint = nri::BindPoint::INHERIT;
-        setDescriptorSetDesc.descriptorSet = descriptorSet;
-        setDescriptorSetDesc.setIndex = 0;
-        NRI.CmdSetDescriptorSet(commandBuffer, setDescriptorSetDesc);
-    }
-
-    BufferResource& argBuffer = GetBuffer(desc.indirectArg, geometryId);
-    if (argBuffer.state != nri::AccessBits::ARGUMENT_BUFFER) {
-        nri::BufferBarrierDesc bufferBarrier = {};
-        bufferBarrier.buffer = argBuffer.buffer;
-        bufferBarrier.before.access = argBuffer.state;
-        bufferBarrier.before.stages = nri::StageBits::ALL;
-        bufferBarrier.after.access = nri::AccessBits::ARGUMENT_BUFFER;
-        bufferBarrier.after.stages = nri::StageBits::ALL;
+    SetDescriptorSet(commandBuffer, descriptorSet);
 
-        nri::BarrierDesc transition = {};
-        transition.bufferNum = 1;
-        transition.buffers = &bufferBarrier;
-        NRI.CmdBarrier(commandBuffer, transition);
-
-        argBuffer.state = nri::AccessBits::ARGUMENT_BUFFER;
-    }
+    BufferResource& argBuffer = GetBuffer(desc.indirectArg, geometryId); // in ARGUMENT_BUFFER state, see AddToBatch
 
     nri::AttachmentsDesc frameBuffer = {};
     frameBuffer.colors = &m_ColorDescriptorPerPipeline[desc.pipelineIndex];
@@ -1035,12 +1095,12 @@ void OmmBakerGpuIntegration::DispatchDrawIndexedIndirect(nri::CommandBuffer& com
     NRI.CmdBeginRendering(commandBuffer, frameBuffer);
     {
         BufferResource& indexBuffer = GetBuffer(desc.indexBuffer, geometryId);
-        NRI.CmdSetIndexBuffer(commandBuffer, *indexBuffer.buffer, desc.indexBufferOffset, nri::IndexType::UINT32);
+        NRI.CmdSetIndexBuffer(commandBuffer, *indexBuffer.buffer, indexBuffer.offset + desc.indexBufferOffset, nri::IndexType::UINT32);
 
-        uint64_t offset = desc.vertexBufferOffset;
+        BufferResource& vertexBufferResource = GetBuffer(desc.vertexBuffer, geometryId);
         nri::VertexBufferDesc vertexBuffer = {};
-        vertexBuffer.buffer = GetBuffer(desc.vertexBuffer, geometryId).buffer;
-        vertexBuffer.offset = offset;
+        vertexBuffer.buffer = vertexBufferResource.buffer;
+        vertexBuffer.offset = vertexBufferResource.offset + desc.vertexBufferOffset;
         vertexBuffer.stride = sizeof(uint32_t);
         NRI.CmdSetVertexBuffers(commandBuffer, 0, &vertexBuffer, 1);
 
@@ -1060,91 +1120,330 @@ void OmmBakerGpuIntegration::DispatchDrawIndexedIndirect(nri::CommandBuffer& com
         scissorRect.height = nri::Dim_t(desc.viewport.maxHeight);
         NRI.CmdSetScissors(commandBuffer, &scissorRect, 1);
 
-        NRI.CmdDrawIndexedIndirect(commandBuffer, *argBuffer.buffer, desc.indirectArgByteOffset, 1, 20, nullptr, 0); // TODO: replace last constant with a GAPI related var
+        NRI.CmdDrawIndexedIndirect(commandBuffer, *argBuffer.buffer, argBuffer.offset + desc.indirectArgByteOffset, 1, 20, nullptr, 0); // TODO: replace last constant with a GAPI related var
     }
     NRI.CmdEndRendering(commandBuffer);
-
-    InsertUavBarriers(commandBuffer, desc.resources, desc.resourceNum, geometryId);
 }
 
-void PostBakeBufferTransition(std::vector<nri::BufferBarrierDesc>& transition, BufferResource& buffer) {
-    if (buffer.buffer && buffer.state != nri::AccessBits::COPY_SOURCE) {
-        nri::BufferBarrierDesc barrier = {};
-        barrier.buffer = buffer.buffer;
-        barrier.before.access = buffer.state;
-        barrier.before.stages = nri::StageBits::ALL;
-        barrier.after.access = nri::AccessBits::COPY_SOURCE;
-        barrier.after.stages = nri::StageBits::ALL;
-        transition.push_back(barrier);
-    }
-}
-
-void OmmBakerGpuIntegration::GenerateVisibilityMaskGPU(nri::CommandBuffer& commandBuffer, uint32_t geometryId) {
+void OmmBakerGpuIntegration::GenerateVisibilityMaskGPU(uint32_t geometryId) {
     GeometryQueueInstance& instance = m_GeometryQueue[geometryId];
     ommGpuDispatchConfigDesc& dispatchConfigDesc = instance.dispatchConfigDesc;
 
     const ommGpuDispatchChain* dispatchChain = nullptr;
     ommGpuDispatch(m_Pipeline, &dispatchConfigDesc, &dispatchChain);
 
-    // Update and set descriptor pool
+    // Reserve descriptors
     UpdateDescriptorPool(geometryId, dispatchChain);
-    NRI.CmdSetDescriptorPool(commandBuffer, *m_NriDescriptorPools[geometryId]);
 
     // Upload constants
-    if (dispatchChain->globalCBufferDataSize) {
-        void* data = NRI.MapBuffer(*m_ConstantBuffer, m_ConstantBufferViewStride * (uint64_t)geometryId, dispatchChain->globalCBufferDataSize);
-        memcpy(data, dispatchChain->globalCBufferData, dispatchChain->globalCBufferDataSize);
-        NRI.UnmapBuffer(*m_ConstantBuffer);
-    }
+    if (dispatchChain->globalCBufferDataSize)
+        memcpy(m_ConstantBufferRing.data + uint64_t(m_ConstantBufferViewStride) * instance.constantBufferSlot, dispatchChain->globalCBufferData, dispatchChain->globalCBufferDataSize);
 
+    // Copy the chain. Labels are dropped, every wave gets one annotation instead
+    size_t resourceNum = 0;
+    size_t localConstantsSize = 0;
     for (uint32_t i = 0; i < dispatchChain->numDispatches; ++i) {
         const ommGpuDispatchDesc& dispacthDesc = dispatchChain->dispatches[i];
+        if (dispacthDesc.type != ommGpuDispatchType_BeginLabel && dispacthDesc.type != ommGpuDispatchType_EndLabel) {
+            resourceNum += dispacthDesc.compute.resourceNum;
+            localConstantsSize += dispacthDesc.compute.localConstantBufferDataSize;
+        }
+    }
+
+    instance.dispatches.clear();
+    instance.resources.clear();
+    instance.resources.reserve(resourceNum); // pointers into the copies must stay valid
+    instance.localConstants.clear();
+    instance.localConstants.reserve(localConstantsSize);
+
+    auto relocate = [&](auto& desc) {
+        const ommGpuResource* resources = desc.resources;
+        desc.resources = instance.resources.data() + instance.resources.size();
+        instance.resources.insert(instance.resources.end(), resources, resources + desc.resourceNum);
+
+        const uint8_t* localConstants = (const uint8_t*)desc.localConstantBufferData;
+        desc.localConstantBufferData = instance.localConstants.data() + instance.localConstants.size();
+        instance.localConstants.insert(instance.localConstants.end(), localConstants, localConstants + desc.localConstantBufferDataSize);
+    };
+
+    for (uint32_t i = 0; i < dispatchChain->numDispatches; ++i) {
+        ommGpuDispatchDesc dispacthDesc = dispatchChain->dispatches[i];
         switch (dispacthDesc.type) {
-            case ommGpuDispatchType_BeginLabel:
-                NRI.CmdBeginAnnotation(commandBuffer, dispacthDesc.beginLabel.debugName, 0);
+            case ommGpuDispatchType_Compute:
+                relocate(dispacthDesc.compute);
                 break;
-            case ommGpuDispatchType_Compute: {
-                const ommGpuComputeDesc& desc = dispacthDesc.compute;
-                DispatchCompute(commandBuffer, desc, geometryId);
+            case ommGpuDispatchType_ComputeIndirect:
+                relocate(dispacthDesc.computeIndirect);
                 break;
-            }
-            case ommGpuDispatchType_ComputeIndirect: {
-                const ommGpuComputeIndirectDesc& desc = dispacthDesc.computeIndirect;
-                DispatchComputeIndirect(commandBuffer, desc, geometryId);
+            case ommGpuDispatchType_DrawIndexedIndirect:
+                relocate(dispacthDesc.drawIndexedIndirect);
                 break;
-            }
-            case ommGpuDispatchType_DrawIndexedIndirect: {
-                const ommGpuDrawIndexedIndirectDesc& desc = dispacthDesc.drawIndexedIndirect;
-                DispatchDrawIndexedIndirect(commandBuffer, desc, geometryId);
+            default:
+                continue;
+        }
+        instance.dispatches.push_back(dispacthDesc);
+    }
+}
+
+constexpr uint32_t WrittenBufferMaxNum = 6 + OMM_MAX_TRANSIENT_POOL_BUFFERS;
+
+inline uint32_t GetWrittenBuffers(InputGeometryDesc& desc, BufferResource** buffers) { // outputs and transient pools are the only buffers the baker writes
+    BakerOutputs& outputs = desc.outputs;
+    uint32_t bufferNum = 0;
+    buffers[bufferNum++] = &outputs.outArrayData;
+    buffers[bufferNum++] = &outputs.outDescArray;
+    buffers[bufferNum++] = &outputs.outIndexBuffer;
+    buffers[bufferNum++] = &outputs.outArrayHistogram;
+    buffers[bufferNum++] = &outputs.outIndexHistogram;
+    buffers[bufferNum++] = &outputs.outPostBuildInfo;
+    for (size_t i = 0; i < OMM_MAX_TRANSIENT_POOL_BUFFERS; ++i)
+        buffers[bufferNum++] = &desc.inputs.inTransientPool[i];
+
+    return bufferNum;
+}
+
+inline bool IsOverlapping(const BufferResource& a, const BufferResource& b) {
+    if (!a.buffer || a.buffer != b.buffer)
+        return false;
+
+    uint64_t aEnd = a.dataSize ? a.offset + a.dataSize : a.size;
+    uint64_t bEnd = b.dataSize ? b.offset + b.dataSize : b.size;
+    return a.offset < bEnd && b.offset < aEnd;
+}
+
+uint32_t OmmBakerGpuIntegration::GetWaveEnd(uint32_t firstGeometryId) { // consecutive geometries writing disjoint memory
+    std::vector<const BufferResource*> waveBuffers;
+    uint32_t geometryId = firstGeometryId;
+    for (; geometryId < (uint32_t)m_GeometryQueue.size(); ++geometryId) {
+        BufferResource* buffers[WrittenBufferMaxNum];
+        uint32_t bufferNum = GetWrittenBuffers(*m_GeometryQueue[geometryId].desc, buffers);
+
+        bool isOverlapping = false;
+        for (uint32_t i = 0; i < bufferNum && !isOverlapping; ++i) {
+            for (const BufferResource* waveBuffer : waveBuffers)
+                isOverlapping |= IsOverlapping(*buffers[i], *waveBuffer);
+        }
+        if (isOverlapping)
+            break;
+
+        waveBuffers.insert(waveBuffers.end(), buffers, buffers + bufferNum);
+    }
+
+    return geometryId;
+}
+
+OmmBakerGpuIntegration::TrackedBuffer& OmmBakerGpuIntegration::GetTrackedBuffer(const BufferResource& buffer) {
+    for (TrackedBuffer& trackedBuffer : m_TrackedBuffers) {
+        if (trackedBuffer.buffer == buffer.buffer)
+            return trackedBuffer;
+    }
+
+    return m_TrackedBuffers.emplace_back(TrackedBuffer{buffer.buffer, buffer.state, uint32_t(~0), false});
+}
+
+bool OmmBakerGpuIntegration::RequestBufferState(const BufferResource& buffer, nri::AccessBits state, bool isDryRun) {
+    TrackedBuffer& trackedBuffer = GetTrackedBuffer(buffer);
+    bool isCompatible = trackedBuffer.batchId != m_BatchId || trackedBuffer.state == state; // a buffer keeps one state within a batch
+    if (isDryRun)
+        return isCompatible;
+
+    if (trackedBuffer.state != state) {
+        nri::BufferBarrierDesc& barrier = m_BatchBarriers.emplace_back();
+        barrier.buffer = trackedBuffer.buffer;
+        barrier.before.access = trackedBuffer.state;
+        barrier.before.stages = nri::StageBits::ALL;
+        barrier.after.access = state;
+        barrier.after.stages = nri::StageBits::ALL;
+
+        trackedBuffer.state = state;
+        trackedBuffer.isPendingUav = false; // the transition orders the previous writes
+    }
+    trackedBuffer.batchId = m_BatchId;
+
+    return isCompatible;
+}
+
+inline uint32_t GetPipelineIndex(const ommGpuDispatchDesc& desc) {
+    switch (desc.type) {
+        case ommGpuDispatchType_Compute:
+            return desc.compute.pipelineIndex;
+        case ommGpuDispatchType_ComputeIndirect:
+            return desc.computeIndirect.pipelineIndex;
+        case ommGpuDispatchType_DrawIndexedIndirect:
+            return desc.drawIndexedIndirect.pipelineIndex;
+        default:
+            return 0;
+    }
+}
+
+bool OmmBakerGpuIntegration::AddToBatch(const ommGpuDispatchDesc& desc, uint32_t geometryId, bool isDryRun) {
+    bool isCompatible = true;
+    const ommGpuComputeDesc& compute = desc.compute; // resources lead every dispatch desc
+    for (uint32_t i = 0; i < compute.resourceNum; ++i) {
+        const ommGpuResource& resource = compute.resources[i];
+        if (resource.type != ommGpuResourceType_IN_ALPHA_TEXTURE)
+            isCompatible &= RequestBufferState(GetBuffer(resource, geometryId), GetNriResourceState(resource.stateNeeded), isDryRun);
+    }
+
+    if (desc.type == ommGpuDispatchType_ComputeIndirect)
+        isCompatible &= RequestBufferState(GetBuffer(desc.computeIndirect.indirectArg, geometryId), nri::AccessBits::ARGUMENT_BUFFER, isDryRun);
+    else if (desc.type == ommGpuDispatchType_DrawIndexedIndirect)
+        isCompatible &= RequestBufferState(GetBuffer(desc.drawIndexedIndirect.indirectArg, geometryId), nri::AccessBits::ARGUMENT_BUFFER, isDryRun);
+
+    if (!isDryRun)
+        m_BatchDispatches.push_back({&desc, geometryId});
+
+    return isCompatible;
+}
+
+void OmmBakerGpuIntegration::FlushBatch(nri::CommandBuffer& commandBuffer) {
+    if (m_BatchDispatches.empty())
+        return;
+
+    for (TrackedBuffer& trackedBuffer : m_TrackedBuffers) { // order the writes of the previous batch
+        if (trackedBuffer.isPendingUav) {
+            nri::BufferBarrierDesc& barrier = m_BatchBarriers.emplace_back();
+            barrier.buffer = trackedBuffer.buffer;
+            barrier.before = {trackedBuffer.state, nri::StageBits::ALL};
+            barrier.after = {trackedBuffer.state, nri::StageBits::ALL};
+            trackedBuffer.isPendingUav = false;
+        }
+    }
+
+    nri::BarrierDesc barrierDesc = {};
+    barrierDesc.bufferNum = (uint32_t)m_BatchBarriers.size();
+    barrierDesc.buffers = m_BatchBarriers.data();
+    if (barrierDesc.bufferNum)
+        NRI.CmdBarrier(commandBuffer, barrierDesc);
+
+    // dispatches of a batch are independent. Grouping them by pipeline lets PrepareDispatch skip redundant binds
+    std::stable_sort(m_BatchDispatches.begin(), m_BatchDispatches.end(), [](const BatchDispatch& a, const BatchDispatch& b) {
+        return GetPipelineIndex(*a.desc) < GetPipelineIndex(*b.desc);
+    });
+
+    for (const BatchDispatch& dispatch : m_BatchDispatches) {
+        nri::DescriptorPool* descriptorPool = m_GeometryQueue[dispatch.geometryId].descriptorPool;
+        if (descriptorPool != m_BoundDescriptorPool) {
+            NRI.CmdSetDescriptorPool(commandBuffer, *descriptorPool);
+            m_BoundDescriptorPool = descriptorPool;
+            m_BoundDescriptorSet = nullptr; // sets are rebound after a pool change
+        }
+
+        switch (dispatch.desc->type) {
+            case ommGpuDispatchType_Compute:
+                DispatchCompute(commandBuffer, dispatch.desc->compute, dispatch.geometryId);
                 break;
-            }
-            case ommGpuDispatchType_EndLabel:
-                NRI.CmdEndAnnotation(commandBuffer);
+            case ommGpuDispatchType_ComputeIndirect:
+                DispatchComputeIndirect(commandBuffer, dispatch.desc->computeIndirect, dispatch.geometryId);
+                break;
+            case ommGpuDispatchType_DrawIndexedIndirect:
+                DispatchDrawIndexedIndirect(commandBuffer, dispatch.desc->drawIndexedIndirect, dispatch.geometryId);
                 break;
             default:
                 break;
         }
     }
 
-    BakerOutputs& outputs = instance.desc->outputs;
-    BakerInputs& inputs = instance.desc->inputs;
-    std::vector<nri::BufferBarrierDesc> outputBuffersTransition = {};
-    PostBakeBufferTransition(outputBuffersTransition, outputs.outArrayData);
-    PostBakeBufferTransition(outputBuffersTransition, outputs.outDescArray);
-    PostBakeBufferTransition(outputBuffersTransition, outputs.outIndexBuffer);
-    PostBakeBufferTransition(outputBuffersTransition, outputs.outArrayHistogram);
-    PostBakeBufferTransition(outputBuffersTransition, outputs.outIndexHistogram);
-    PostBakeBufferTransition(outputBuffersTransition, outputs.outPostBuildInfo);
+    for (const BatchDispatch& dispatch : m_BatchDispatches) {
+        const ommGpuComputeDesc& compute = dispatch.desc->compute;
+        for (uint32_t i = 0; i < compute.resourceNum; ++i) {
+            if (compute.resources[i].stateNeeded == ommGpuDescriptorType_RawBufferWrite)
+                GetTrackedBuffer(GetBuffer(compute.resources[i], dispatch.geometryId)).isPendingUav = true;
+        }
+    }
 
-    for (size_t i = 0; i < OMM_MAX_TRANSIENT_POOL_BUFFERS; ++i)
-        PostBakeBufferTransition(outputBuffersTransition, inputs.inTransientPool[i]);
+    m_BatchBarriers.clear();
+    m_BatchDispatches.clear();
+    ++m_BatchId;
+}
+
+void OmmBakerGpuIntegration::RecordWave(nri::CommandBuffer& commandBuffer, uint32_t firstGeometryId, uint32_t endGeometryId) {
+    size_t stepNum = 0;
+    for (uint32_t geometryId = firstGeometryId; geometryId < endGeometryId; ++geometryId)
+        stepNum = std::max(stepNum, m_GeometryQueue[geometryId].dispatches.size());
+
+    NRI.CmdBeginAnnotation(commandBuffer, "OMM bake wave", 0);
+    for (size_t step = 0; step < stepNum; ++step) {
+        for (uint32_t geometryId = firstGeometryId; geometryId < endGeometryId; ++geometryId) {
+            const std::vector<ommGpuDispatchDesc>& dispatches = m_GeometryQueue[geometryId].dispatches;
+            if (step >= dispatches.size())
+                continue;
+
+            if (!AddToBatch(dispatches[step], geometryId, true)) // a buffer is needed in another state, it takes a new batch
+                FlushBatch(commandBuffer);
+            AddToBatch(dispatches[step], geometryId, false);
+        }
+        FlushBatch(commandBuffer);
+    }
+    NRI.CmdEndAnnotation(commandBuffer);
+}
+
+void OmmBakerGpuIntegration::FinishBake(nri::CommandBuffer& commandBuffer) {
+    for (GeometryQueueInstance& instance : m_GeometryQueue) { // written buffers are copied out after the bake
+        BufferResource* buffers[WrittenBufferMaxNum];
+        uint32_t bufferNum = GetWrittenBuffers(*instance.desc, buffers);
+        for (uint32_t i = 0; i < bufferNum; ++i) {
+            if (buffers[i]->buffer)
+                RequestBufferState(*buffers[i], nri::AccessBits::COPY_SOURCE, false);
+        }
+    }
+
+    nri::BarrierDesc barrierDesc = {};
+    barrierDesc.bufferNum = (uint32_t)m_BatchBarriers.size();
+    barrierDesc.buffers = m_BatchBarriers.data();
+    if (barrierDesc.bufferNum)
+        NRI.CmdBarrier(commandBuffer, barrierDesc);
+
+    // BufferResources sharing a buffer leave the bake in its final state
+    auto updateState = [&](BufferResource& buffer) {
+        for (const TrackedBuffer& trackedBuffer : m_TrackedBuffers) {
+            if (trackedBuffer.buffer == buffer.buffer)
+                buffer.state = trackedBuffer.state;
+        }
+    };
+
+    for (GeometryQueueInstance& instance : m_GeometryQueue) {
+        BakerInputs& inputs = instance.desc->inputs;
+        updateState(inputs.inUvBuffer);
+        updateState(inputs.inIndexBuffer);
+        updateState(inputs.inSubdivisionLevelBuffer);
+
+        BufferResource* buffers[WrittenBufferMaxNum];
+        uint32_t bufferNum = GetWrittenBuffers(*instance.desc, buffers);
+        for (uint32_t i = 0; i < bufferNum; ++i)
+            updateState(*buffers[i]);
+    }
 
-    nri::BarrierDesc transitionBarriers = {};
-    transitionBarriers.bufferNum = (uint32_t)outputBuffersTransition.size();
-    transitionBarriers.buffers = outputBuffersTransition.data();
+    for (BufferResource& staticBuffer : m_StaticBuffers)
+        updateState(staticBuffer);
 
-    if (transitionBarriers.bufferNum)
-        NRI.CmdBarrier(commandBuffer, transitionBarriers);
+    m_TrackedBuffers.clear();
+    m_BatchBarriers.clear();
+    m_BoundDescriptorPool = nullptr;
+}
+
+void OmmBakerGpuIntegration::WarmUp(InputGeometryDesc* geometryDesc, uint32_t geometryNum) {
+    for (uint32_t i = 0; i < geometryNum; ++i) {
+        ommGpuDispatchConfigDesc dispatchConfigDesc = {};
+        FillDispatchConfigDesc(dispatchConfigDesc, geometryDesc[i]);
+
+        const ommGpuDispatchChain* dispatchChain = nullptr;
+        ommResult ommResult = ommGpuDispatch(m_Pipeline, &dispatchConfigDesc, &dispatchChain);
+        if (ommResult != ommResult_SUCCESS) {
+            printf("[FAIL][OMM][GPU] ommGpuDispatch failed.\n");
+            std::abort();
+        }
+
+        for (uint32_t j = 0; j < dispatchChain->numDispatches; ++j) {
+            const ommGpuDispatchDesc& dispacthDesc = dispatchChain->dispatches[j];
+            if (dispacthDesc.type == ommGpuDispatchType_BeginLabel || dispacthDesc.type == ommGpuDispatchType_EndLabel)
+                continue;
+
+            uint32_t pipelineIndex = GetPipelineIndex(dispacthDesc);
+            if (m_NriPipelines[pipelineIndex] == nullptr)
+                CreatePipeline(pipelineIndex);
+        }
+    }
 }
 
 void OmmBakerGpuIntegration::Bake(nri::CommandBuffer& commandBuffer, InputGeometryDesc* geometryDesc, uint32_t geometryNum) {
@@ -1153,10 +1452,22 @@ void OmmBakerGpuIntegration::Bake(nri::CommandBuffer& commandBuffer, InputGeomet
 
     AddGeometryToQueue(geometryDesc, geometryNum);
     UpdateGlobalConstantBuffer();
-    m_NriDescriptorPools.resize(geometryNum);
+
+    m_BoundPipelineLayout = nullptr;
+    m_BoundPipeline = nullptr;
+    m_BoundDescriptorSet = nullptr;
+    m_BindStats = {};
 
     for (uint32_t i = 0; i < geometryNum; ++i)
-        GenerateVisibilityMaskGPU(commandBuffer, i);
+        GenerateVisibilityMaskGPU(i);
+
+    // geometries of a wave are recorded step by step, so their dispatches overlap between barriers
+    for (uint32_t firstGeometryId = 0; firstGeometryId < geometryNum;) {
+        uint32_t endGeometryId = GetWaveEnd(firstGeometryId);
+        RecordWave(commandBuffer, firstGeometryId, endGeometryId);
+        firstGeometryId = endGeometryId;
+    }
+    FinishBake(commandBuffer);
 
     m_GeometryQueue.clear();
 }
@@ -1164,37 +1475,39 @@ void OmmBakerGpuIntegration::Bake(nri::CommandBuffer& commandBuffer, InputGeomet
 void OmmBakerGpuIntegration::ReleaseTemporalResources() {
     m_GeometryQueue.resize(0);
     m_GeometryQueue.shrink_to_fit();
-    m_NriDescriptorSets.clear();
-
-    for (auto it = m_NriDescriptors.begin(); it != m_NriDescriptors.end();) {
-        if (it->second)
-            NRI.DestroyDescriptor(it->second);
-        it = m_NriDescriptors.erase(it);
-    }
-
-    for (auto& pool : m_NriDescriptorPools) {
-        if (pool) {
-            NRI.DestroyDescriptorPool(pool);
-            pool = nullptr;
-        }
-    }
-    m_NriDescriptorPools.resize(0);
-    m_NriDescriptorPools.shrink_to_fit();
-
-    if (m_ConstantBuffer)
-        NRI.DestroyBuffer(m_ConstantBuffer);
-    for(auto& view : m_ConstantBufferViews)
-        NRI.DestroyDescriptor(view);
-    if (m_ConstantBufferHeap)
-        NRI.FreeMemory(m_ConstantBufferHeap);
-    m_ConstantBufferViewStride = m_ConstantBufferSize = 0;
-    m_ConstantBuffer = nullptr;
-    m_ConstantBufferHeap = nullptr;
-    m_ConstantBufferViews.resize(0);
-    m_ConstantBufferViews.shrink_to_fit();
+    m_NriDescriptorSets.Clear();
+
+    // cached views stay alive, descriptor sets are released all at once
+    for (auto& pool : m_RetiredDescriptorPools)
+        NRI.DestroyDescriptorPool(pool);
+    m_RetiredDescriptorPools.clear();
+    if (m_NriDescriptorPool)
+        NRI.ResetDescriptorPool(*m_NriDescriptorPool);
+    m_DescriptorPoolUsage = {};
+
+    for (ConstantBufferRing& ring : m_RetiredConstantBufferRings)
+        DestroyConstantBufferRing(ring);
+    m_RetiredConstantBufferRings.clear();
+    m_ConstantBufferNextSlot = 0;
 }
 
 void OmmBakerGpuIntegration::Destroy() {
+    for (ConstantBufferRing& ring : m_RetiredConstantBufferRings)
+        DestroyConstantBufferRing(ring);
+    m_RetiredConstantBufferRings.clear();
+    DestroyConstantBufferRing(m_ConstantBufferRing);
+
+    m_NriDescriptors.ForEach([&](const ViewKey&, nri::Descriptor* view) { NRI.DestroyDescriptor(view); });
+    m_NriDescriptors.Clear();
+
+    for (auto& pool : m_RetiredDescriptorPools)
+        NRI.DestroyDescriptorPool(pool);
+    m_RetiredDescriptorPools.clear();
+    if (m_NriDescriptorPool) {
+        NRI.DestroyDescriptorPool(m_NriDescriptorPool);
+        m_NriDescriptorPool = nullptr;
+    }
+
     if (m_DebugTextureDescriptor) {
         NRI.DestroyDescriptor(m_DebugTextureDescriptor);
         m_DebugTextureDescriptor = nullptr;
@@ -1217,10 +1530,12 @@ void OmmBakerGpuIntegration::Destroy() {
     for (auto& pipeline : m_NriPipelines)
         if (pipeline)
             NRI.DestroyPipeline(pipeline);
+    m_NriPipelines.clear();
 
     for (auto& layout : m_NriPipelineLayouts)
         if (layout)
             NRI.DestroyPipelineLayout(layout);
+    m_NriPipelineLayouts.clear();
 
     for (uint32_t i = 0; i < (uint32_t)GpuStaticResources::Count; ++i) {
         if (m_StaticBuffers[i].buffer)
@@ -9,7 +9,9 @@ license agreement from NVIDIA CORPORATION is strictly prohibited.
 */
 
 #pragma once
-#include <map>
+#include <algorithm>
+#include <cstring>
+#include <tuple>
 #include <vector>
 
 #include "../../External/NRIFramework/External/NRI/Include/NRI.h"
@@ -39,6 +41,7 @@ struct BufferResource {
     uint64_t offsetInStruct;
     uint64_t numElements;
     nri::AccessBits state;
+    uint64_t dataSize; // bytes used from offset, 0 means up to the end of the buffer. Geometries with overlapping ranges are never interleaved
 };
 
 struct PrebuildInfo {
@@ -134,14 +137,144 @@ struct InputGeometryDesc {
     BakerSettings settings;
 };
 
+struct BakerBindStats { // state binds recorded by the last Bake, and the ones skipped as redundant
+    uint32_t pipelineNum;
+    uint32_t pipelineSkippedNum;
+    uint32_t pipelineLayoutNum;
+    uint32_t pipelineLayoutSkippedNum;
+    uint32_t descriptorSetNum;
+    uint32_t descriptorSetSkippedNum;
+};
+
+inline uint64_t HashMix(uint64_t h) { // 64-bit finalizer, every input bit affects every output bit
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdull;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+inline uint64_t HashBytes(const void* data, size_t size, uint64_t seed) { // consumes 8 bytes per step
+    const uint8_t* p = (const uint8_t*)data;
+    uint64_t result = seed;
+    for (; size >= sizeof(uint64_t); size -= sizeof(uint64_t), p += sizeof(uint64_t)) {
+        uint64_t word;
+        memcpy(&word, p, sizeof(word));
+        result = (result ^ word) * 0x9e3779b97f4a7c15ull;
+        result ^= result >> 29;
+    }
+
+    uint64_t tail = 0;
+    memcpy(&tail, p, size);
+    return HashMix(result ^ tail ^ (uint64_t(size) << 56));
+}
+
+template <typename Key, typename Value, typename Hasher>
+class FlatHashMap { // open addressing with linear probing. A lookup touches one contiguous array instead of chasing tree nodes
+public:
+    Value* Find(const Key& key) {
+        if (m_Size == 0)
+            return nullptr;
+
+        for (size_t i = Hasher()(key) & m_Mask;; i = (i + 1) & m_Mask) {
+            Slot& slot = m_Slots[i];
+            if (!slot.isUsed)
+                return nullptr;
+            if (slot.key == key)
+                return &slot.value;
+        }
+    }
+
+    Value& Insert(const Key& key, const Value& value) { // the key must not be present
+        if ((m_Size + 1) * 4 > m_Slots.size() * 3) // max load factor 0.75
+            Rehash(std::max<size_t>(m_Slots.size() * 2, 16));
+
+        size_t i = Hasher()(key) & m_Mask;
+        while (m_Slots[i].isUsed)
+            i = (i + 1) & m_Mask;
+
+        m_Slots[i] = {key, value, true};
+        ++m_Size;
+        return m_Slots[i].value;
+    }
+
+    template <typename Predicate>
+    void EraseIf(Predicate predicate) { // rebuilds the table, meant for rare bulk removals
+        std::vector<Slot> slots;
+        slots.swap(m_Slots);
+        m_Slots.resize(slots.size());
+        m_Size = 0;
+        for (Slot& slot : slots) {
+            if (slot.isUsed && !predicate(slot.key, slot.value))
+                Insert(slot.key, slot.value);
+        }
+    }
+
+    template <typename Function>
+    void ForEach(Function function) {
+        for (Slot& slot : m_Slots) {
+            if (slot.isUsed)
+                function(slot.key, slot.value);
+        }
+    }
+
+    void Clear() { // keeps the capacity
+        std::fill(m_Slots.begin(), m_Slots.end(), Slot{});
+        m_Size = 0;
+    }
+
+    size_t Size() const {
+        return m_Size;
+    }
+
+private:
+    struct Slot {
+        Key key;
+        Value value;
+        bool isUsed;
+    };
+
+    void Rehash(size_t capacity) {
+        std::vector<Slot> slots(capacity);
+        slots.swap(m_Slots);
+        m_Mask = capacity - 1;
+        m_Size = 0;
+        for (Slot& slot : slots) {
+            if (slot.isUsed)
+                Insert(slot.key, slot.value);
+        }
+    }
+
+    std::vector<Slot> m_Slots;
+    size_t m_Mask = 0;
+    size_t m_Size = 0;
+};
+
+using ViewKey = std::tuple<const void*, uint64_t, uint64_t, nri::Format, uint32_t>; // resource, offset or mip offset, size, format, view type. At namespace scope for OMMLookupBench
+struct ViewKeyHasher {
+    uint64_t operator()(const ViewKey& key) const {
+        uint64_t h = HashMix((uint64_t)(uintptr_t)std::get<0>(key) ^ std::get<1>(key));
+        return HashMix(h ^ std::get<2>(key) ^ (uint64_t(std::get<3>(key)) << 32 | std::get<4>(key)));
+    }
+};
+
 class OmmBakerGpuIntegration {
 public:
     void Initialize(nri::Device& device);                                                                // 0.
     void GetPrebuildInfo(InputGeometryDesc* geometryDesc, uint32_t geometryNum);                         // 1. Get info on output resources sizes
+    void WarmUp(InputGeometryDesc* geometryDesc, uint32_t geometryNum);                                  // Optional. Creates the pipelines and debug resources the geometries need, otherwise the first Bake does
+    void CreateCachedPipelines(const char* filename);                                                    // Optional. Creates the pipelines recorded by SavePipelineCache, no-op if the file is missing or outdated
+    void SavePipelineCache(const char* filename);                                                        // Optional. Records the pipelines created so far. Call before Destroy
     void Bake(nri::CommandBuffer& commandBuffer, InputGeometryDesc* geometryDesc, uint32_t geometryNum); // 2. After the queue is ready kick off the baker
     void ReleaseTemporalResources();                                                                     // 3. Clean up internal data after work is finished
+    void ReleaseResourceViews(const void* resource);                                                     // Views are cached across bakes. Call before destroying a buffer or texture used by the baker
     void Destroy();                                                                                      // 4.
 
+    const BakerBindStats& GetBindStats() const {
+        return m_BindStats;
+    }
+
 private:
     struct NRIInterface
         : public nri::CoreInterface,
@@ -156,45 +289,103 @@ private:
     struct GeometryQueueInstance {
         InputGeometryDesc* desc;
         ommGpuDispatchConfigDesc dispatchConfigDesc;
+        uint32_t constantBufferSlot;
+        nri::DescriptorPool* descriptorPool;
+
+        // copy of the dispatch chain without labels. The SDK reuses its storage on the next ommGpuDispatch call
+        std::vector<ommGpuDispatchDesc> dispatches;
+        std::vector<ommGpuResource> resources;
+        std::vector<uint8_t> localConstants;
+    };
+
+    struct TrackedBuffer { // state of a buffer shared by several BufferResources during a bake
+        nri::Buffer* buffer;
+        nri::AccessBits state;
+        uint32_t batchId;  // last batch using the buffer
+        bool isPendingUav; // written by the last recorded batch
+    };
+
+    struct BatchDispatch {
+        const ommGpuDispatchDesc* desc;
+        uint32_t geometryId;
+    };
+
+    struct ConstantBufferRing { // persistently mapped, one slot with its own view per geometry
+        nri::Buffer* buffer;
+        nri::Memory* memory;
+        uint8_t* data;
+        std::vector<nri::Descriptor*> views;
     };
 
 private:
     // On Init
-    void CreateTextures(uint32_t pipelineNum);
+    void CreateDebugTexture();
     void CreateSamplers(const ommGpuPipelineInfoDesc* pipelinesInfo);
-    void CreatePipelines(const ommGpuPipelineInfoDesc* pipelinesInfo);
+    void CreatePipeline(uint32_t pipelineIndex);
     void CreateComputePipeline(uint32_t id, const ommGpuPipelineInfoDesc* pipelineInfo);
     void CreateGraphicsPipeline(uint32_t id, const ommGpuPipelineInfoDesc* pipelineInfo);
     void CreateStaticResources(nri::Queue* commandQueue);
+    uint64_t CalculatePipelineCacheKey() const;
 
     // On Submit
     void AddGeometryToQueue(InputGeometryDesc* geometryDesc, uint32_t geometryNum);
 
     // On Build
     nri::DescriptorSet* PrepareDispatch(nri::CommandBuffer& commandBuffer, const ommGpuResource* resources, uint32_t resourceNum, uint32_t pipelineIndex, uint32_t geometryId);
-    void InsertUavBarriers(nri::CommandBuffer& commandBuffer, const ommGpuResource* resources, uint32_t resourceNum, uint32_t geometryId);
-    void PerformResourceTransition(const ommGpuResource& resource, uint32_t geometryId, std::vector<nri::BufferBarrierDesc>& bufferBarriers);
+    void SetDescriptorSet(nri::CommandBuffer& commandBuffer, nri::DescriptorSet* descriptorSet);
     BufferResource& GetBuffer(const ommGpuResource& resource, uint32_t geometryId);
 
+    // Scheduling. Step K of every geometry in a wave is recorded before step K + 1, dispatches of a step share one barrier
+    uint32_t GetWaveEnd(uint32_t firstGeometryId);
+    TrackedBuffer& GetTrackedBuffer(const BufferResource& buffer);
+    bool RequestBufferState(const BufferResource& buffer, nri::AccessBits state, bool isDryRun);
+    bool AddToBatch(const ommGpuDispatchDesc& desc, uint32_t geometryId, bool isDryRun);
+    void FlushBatch(nri::CommandBuffer& commandBuffer);
+    void FinishBake(nri::CommandBuffer& commandBuffer);
+
     void UpdateDescriptorPool(uint32_t geometryId, const ommGpuDispatchChain* dispatchChain);
     void UpdateGlobalConstantBuffer();
+    void DestroyConstantBufferRing(ConstantBufferRing& ring);
 
     nri::Descriptor* GetDescriptor(const ommGpuResource& resource, uint32_t geometryId);
     void DispatchCompute(nri::CommandBuffer& commandBuffer, const ommGpuComputeDesc& desc, uint32_t geometryId);
     void DispatchComputeIndirect(nri::CommandBuffer& commandBuffer, const ommGpuComputeIndirectDesc& desc, uint32_t geometryId);
     void DispatchDrawIndexedIndirect(nri::CommandBuffer& commandBuffer, const ommGpuDrawIndexedIndirectDesc& desc, uint32_t geometryId);
 
-    void GenerateVisibilityMaskGPU(nri::CommandBuffer& commandBuffer, uint32_t geometryId);
+    void GenerateVisibilityMaskGPU(uint32_t geometryId);
+    void RecordWave(nri::CommandBuffer& commandBuffer, uint32_t firstGeometryId, uint32_t lastGeometryId);
 
 private:
     std::vector<GeometryQueueInstance> m_GeometryQueue;
 
+    // scheduling state, valid during Bake
+    std::vector<TrackedBuffer> m_TrackedBuffers; // a bake touches a handful of buffers, a linear search is enough
+    std::vector<nri::BufferBarrierDesc> m_BatchBarriers;
+    std::vector<BatchDispatch> m_BatchDispatches;
+    nri::DescriptorPool* m_BoundDescriptorPool = nullptr;
+    uint32_t m_BatchId = 0;
+
+    // bound state, valid during Bake. Nothing is assumed about the command buffer on entry
+    nri::PipelineLayout* m_BoundPipelineLayout = nullptr;
+    nri::BindPoint m_BoundBindPoint = nri::BindPoint::INHERIT;
+    nri::Pipeline* m_BoundPipeline = nullptr;
+    nri::DescriptorSet* m_BoundDescriptorSet = nullptr;
+    BakerBindStats m_BindStats = {};
+
     // resources
     BufferResource m_StaticBuffers[(uint32_t)GpuStaticResources::Count];
-    std::map<uint64_t, nri::Descriptor*> m_NriDescriptors;
-    std::map<uint64_t, nri::DescriptorSet*> m_NriDescriptorSets;
+    struct DescriptorSetKeyHasher {
+        uint64_t operator()(uint64_t key) const { return key; } // already a hash of the dispatch resources
+    };
+    FlatHashMap<ViewKey, nri::Descriptor*, ViewKeyHasher> m_NriDescriptors;
+    FlatHashMap<uint64_t, nri::DescriptorSet*, DescriptorSetKeyHasher> m_NriDescriptorSets;
     std::vector<nri::Memory*> m_NriStaticMemories;
-    std::vector<nri::DescriptorPool*> m_NriDescriptorPools;
+
+    // descriptor pool. Reset after every submission, replaced by a bigger one when outgrown
+    nri::DescriptorPool* m_NriDescriptorPool = nullptr;
+    nri::DescriptorPoolDesc m_DescriptorPoolCapacity = {};
+    nri::DescriptorPoolDesc m_DescriptorPoolUsage = {};
+    std::vector<nri::DescriptorPool*> m_RetiredDescriptorPools; // outgrown, still referenced by the recorded commands
 
     // samplers
     std::vector<nri::Descriptor*> m_Samplers;
@@ -207,20 +398,19 @@ private:
     NRIInterface NRI = {};
     nri::Device* m_Device;
 
-    // CB
-    std::vector<nri::Descriptor*> m_ConstantBufferViews;
-    nri::Buffer* m_ConstantBuffer;
-    nri::Memory* m_ConstantBufferHeap;
-    uint32_t m_ConstantBufferViewStride;
-    uint32_t m_ConstantBufferSize;
+    // CB. Slots are handed out until the submission is done, then the ring starts over
+    ConstantBufferRing m_ConstantBufferRing = {};
+    std::vector<ConstantBufferRing> m_RetiredConstantBufferRings; // outgrown, still referenced by the recorded commands
+    uint32_t m_ConstantBufferViewStride = 0;
+    uint32_t m_ConstantBufferNextSlot = 0;
 
     // Textures
-    nri::Texture* m_DebugTexture;
-    nri::Memory* m_DebugTextureMemory;
-    nri::Descriptor* m_DebugTextureDescriptor;
+    nri::Texture* m_DebugTexture = nullptr;
+    nri::Memory* m_DebugTextureMemory = nullptr;
+    nri::Descriptor* m_DebugTextureDescriptor = nullptr;
     nri::AccessBits m_DebugTextureState = nri::AccessBits::NONE;
 
-    nri::Descriptor* m_EmptyDescriptor;
+    nri::Descriptor* m_EmptyDescriptor = nullptr;
     std::vector<nri::Descriptor*> m_ColorDescriptorPerPipeline;
 
     const uint32_t m_EmptyFrameBufferId = 0;
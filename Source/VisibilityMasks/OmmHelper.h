@@ -20,9 +20,6 @@ license agreement from NVIDIA CORPORATION is strictly prohibited.
 #endif
 
 #include <vulkan/vulkan.h>
-#include <array>
-#include <map>
-#include <vector>
 
 #include "NRI.h"
 
@@ -32,167 +29,10 @@ license agreement from NVIDIA CORPORATION is strictly prohibited.
 #include "Extensions/NRIWrapperD3D12.h"
 #include "Extensions/NRIWrapperVK.h"
 
-#define OMM_SUPPORTS_CPP17 (1)
-#include "omm.h"
-
+#include "OmmBakeCommon.h"
 #include "OmmBakerIntegration.h"
 
 namespace ommhelper {
-enum class OmmFormats {
-    OC1_2_STATE,
-    OC1_4_STATE,
-    Count
-};
-
-enum class OmmBakeFilter {
-    Nearest = (uint32_t)ommTextureFilterMode_Nearest,
-    Linear = (uint32_t)ommTextureFilterMode_Linear,
-    Count,
-};
-
-enum class OmmBakerType {
-    GPU,
-    CPU,
-    Count
-};
-
-struct CpuBakerFlags {
-    bool enableInternalThreads = true;
-    bool enableSpecialIndices = true;
-    bool enableDuplicateDetection = true;
-    bool enableNearDuplicateDetection = false;
-    bool force32bitIndices = false;
-#if DXR_OMM
-    bool allow8bitIndices = true;
-#else
-    bool allow8bitIndices = false;
-#endif
-};
-
-struct GpuBakerFlags {
-    bool enablePostBuildInfo = true;
-    bool enableSpecialIndices = true;
-    bool enableTexCoordDeduplication = true;
-    bool force32bitIndices = false;
-    bool computeOnlyWorkload = true;
-#if DXR_OMM
-    bool allow8bitIndices = true;
-#else
-    bool allow8bitIndices = false;
-#endif
-};
-
-struct OmmBakeDesc {
-    uint32_t subdivisionLevel = 9; // 4^N
-    uint32_t mipBias = 0;
-    uint32_t mipCount = 1;
-    uint32_t buildFrameId = 0;
-    float dynamicSubdivisionScale = 1.0f;
-    OmmBakeFilter filter = OmmBakeFilter::Linear;
-    OmmFormats format = OmmFormats::OC1_4_STATE;
-    OmmBakerType type = OmmBakerType::GPU;
-    CpuBakerFlags cpuFlags;
-    GpuBakerFlags gpuFlags;
-    bool enableDebugMode = false;
-    bool enableCache = false;
-};
-
-enum class OmmGpuBakerPass {
-    Setup = ommGpuBakeFlags_PerformSetup,
-    Bake = ommGpuBakeFlags_PerformBake,
-    Combined = Setup | Bake,
-};
-
-enum class OmmAlphaMode {
-    Test = (uint32_t)ommAlphaMode_Test,
-    Blend = (uint32_t)ommAlphaMode_Blend,
-    MaxNum = (uint32_t)ommAlphaMode_MAX_NUM,
-};
-
-enum class OmmDataLayout {
-    ArrayData,
-    DescArray,
-    Indices,
-    DescArrayHistogram,
-    IndexHistogram,
-    GpuPostBuildInfo,
-    MaxNum,
-    BlasBuildGpuBuffersNum = DescArrayHistogram,
-    CpuMaxNum = GpuPostBuildInfo,
-    GpuOutputNum = MaxNum,
-};
-
-struct GpuBakerBuffer {
-    nri::Buffer* buffer;
-    uint64_t bufferSize; // total buffer size
-    uint64_t dataSize;
-    uint64_t offset;
-};
-
-struct InputBuffer {
-    union NriBufferOrPtr {
-        nri::Buffer* buffer;
-        void* ptr;
-    } nriBufferOrPtr;
-
-    uint64_t bufferSize; // total buffer size;
-    uint64_t offset;
-    uint64_t numElements;
-    uint64_t stride;
-    uint64_t offsetInStruct;
-    nri::Format format;
-};
-
-#define OMM_MAX_MIP_NUM 16
-
-struct MipDesc {
-    union NriTextureOrPtr {
-        nri::Texture* texture;
-        void* ptr;
-    } nriTextureOrPtr;
-
-    uint32_t width;
-    uint32_t height;
-    uint32_t rowPitch;
-};
-
-struct InputTexture {
-    MipDesc mips[OMM_MAX_MIP_NUM];
-
-    uint32_t mipOffset;
-    uint32_t mipNum;
-
-    uint32_t alphaChannelId;
-    nri::Format format;
-    nri::AddressMode addressingMode;
-};
-
-struct OmmBakeGeometryDesc {
-    InputBuffer indices;
-    InputBuffer uvs;
-    InputTexture texture;
-
-    GpuBakerBuffer gpuBuffers[uint32_t(OmmDataLayout::GpuOutputNum)];
-    GpuBakerBuffer transientBuffers[OMM_MAX_TRANSIENT_POOL_BUFFERS];
-    GpuBakerBuffer readBackBuffers[uint32_t(OmmDataLayout::GpuOutputNum)];
-
-    std::vector<uint8_t> outData[uint32_t(OmmDataLayout::MaxNum)]; // cpu baker outputs/gpu baker readback for caching
-
-    struct GpuBakerPrebuildInfo {
-        uint64_t dataSizes[(uint32_t)OmmDataLayout::GpuOutputNum];
-        uint64_t transientBufferSizes[OMM_MAX_TRANSIENT_POOL_BUFFERS];
-    } gpuBakerPreBuildInfo;
-
-    float alphaCutoff;
-    float borderAlpha;
-
-    uint32_t outIndexHistogramCount;
-    uint32_t outDescArrayHistogramCount;
-    uint32_t outOmmIndexStride;
-    nri::Format outOmmIndexFormat;
-    OmmAlphaMode alphaMode;
-};
-
 struct MaskedGeometryBuildDesc {
     struct Inputs {
         InputBuffer indices;
@@ -220,43 +60,22 @@ struct MaskedGeometryBuildDesc {
     } outputs;
 };
 
-struct OmmCaching {
-    struct MaskHeader {
-        uint64_t instanceHash;
-        uint64_t stateHash;
-        uint64_t sizes[(uint32_t)OmmDataLayout::CpuMaxNum];
-        uint64_t blobSize;
-        uint16_t ommIndexFormat;
-    };
-
-    struct OmmData {
-        void* data[(uint32_t)OmmDataLayout::CpuMaxNum];
-        uint64_t sizes[(uint32_t)OmmDataLayout::CpuMaxNum];
-    };
-
-    static uint64_t CalculateSateHash(const OmmBakeDesc& buildDesc);
-    static bool LookForCache(const char* filename, uint64_t stateMask, uint64_t hash, size_t* dataOffset = nullptr);
-    static bool ReadMaskFromCache(const char* filename, OmmData& data, uint64_t stateMask, uint64_t hash, uint16_t* ommIndexFormat);
-    static void SaveMasksToDisc(const char* filename, const OmmData& data, uint64_t stateMask, uint64_t hash, uint32_t ommIndexFormat);
-    static void CreateFolder(const char* path);
-
-private:
-    static void PrewarmCache(const char* filename, FILE* file, size_t fileSize);
-    static bool WriteChunkToFile(const char* fileName, FILE* file, void* data, size_t size);
-    static bool ValidateChunkRead(const char* fileName, FILE* file, size_t fileSize, size_t currentPos, size_t dataSize);
-    static bool ReadChunkFromFile(const char* fileName, FILE* file, size_t fileSize, void* data, size_t dataSize);
-    static std::map<uint64_t, uint64_t> m_IdentifierToDataOffset;
-};
-
 class OpacityMicroMapsHelper {
 public:
     void Initialize(nri::Device* device, bool disableMaskedGeometryBuild);
 
     void GetGpuBakerPrebuildInfo(OmmBakeGeometryDesc** queue, const size_t count, const OmmBakeDesc& desc);
+    void WarmUpGpuBaker(OmmBakeGeometryDesc** queue, const size_t count, const OmmBakeDesc& desc); // optional, pipelines are created by the first bake otherwise
+    void CreateCachedGpuBakerPipelines(const char* filename);                                       // optional, creates the pipelines recorded by SaveGpuBakerPipelineCache
+    void SaveGpuBakerPipelineCache(const char* filename);                                           // call before Destroy
     void BakeOpacityMicroMapsGpu(nri::CommandBuffer* commandBuffer, OmmBakeGeometryDesc** queue, const size_t count, const OmmBakeDesc& bakeDesc, OmmGpuBakerPass pass);
     void GpuPostBakeCleanUp();
+    void ReleaseGpuBakerViews(const void* resource);
+    const BakerBindStats& GetGpuBakerBindStats() const;
 
-    void BakeOpacityMicroMapsCpu(OmmBakeGeometryDesc** queue, const size_t count, const OmmBakeDesc& desc);
+    void BakeOpacityMicroMapsCpu(OmmBakeGeometryDesc** queue, const size_t count, const OmmBakeDesc& desc, const OmmCancelToken* cancel = nullptr);
+    void ReleaseCpuBakerTextures(const void* alphaData);
+    void CpuPostBakeCleanUp();
     void ConvertUsageCountsToApiFormat(uint8_t* outFormattedBuffer, size_t& outSize, const uint8_t* bakerOutputBuffer, size_t bakerOutputBufferSize);
 
     void GetBlasPrebuildInfo(MaskedGeometryBuildDesc** queue, const size_t count);
@@ -320,7 +139,7 @@ private:
     NriInterface NRI = {};
 
     OmmBakerGpuIntegration m_GpuBakerIntegration;
-    ommBaker m_OmmCpuBaker = 0;
+    OmmCpuBaker m_CpuBaker;
     nri::Device* m_Device;
     bool m_DisableGeometryBuild = false;
 };